@@ -5,8 +5,8 @@ let globals;
 
 //
 // Convert a room name to/from usable coordinates
-// "E1N1" -> { xx: 129, yy: 126 }
-let kWorldSize = 255; // Talk to marcel before growing world larger than W127N127 :: E127S127
+// "E1N1" -> { xx: 32769, yy: 32766 }
+let kWorldSize = 65535; // Native room coordinates are 16 bits, W32767N32767 :: E32767S32767
 function parseRoomName(roomName) {
     let room = /^([WE])([0-9]+)([NS])([0-9]+)$/.exec(roomName);
     if (!room) {
@@ -20,12 +20,43 @@ function parseRoomName(roomName) {
     return { xx: rx, yy: ry };
 }
 
-exports.init = function init(mod, rooms) {
+//
+// Same as `parseRoomName`, but writes xx, yy into `packed` at `index` instead of allocating an object
+// and a regex match for every position of a search
+function packRoomName(roomName, packed, index) {
+    roomName = String(roomName);
+    let ii = 0;
+    for (let axis = 0; axis < 2; ++axis) {
+        let dir = roomName[ii++];
+        let negative = dir === (axis === 0 ? 'W' : 'N');
+        if (!negative && dir !== (axis === 0 ? 'E' : 'S')) {
+            throw new Error('Invalid room name');
+        }
+        let value = 0, start = ii;
+        for (let code; (code = roomName.charCodeAt(ii)) >= 48 && code <= 57; ++ii) {
+            value = value * 10 + code - 48;
+        }
+        let coord = (kWorldSize >> 1) + (negative ? -value : value + 1);
+        if (ii === start || !(coord >= 0 && coord <= kWorldSize)) {
+            throw new Error('Invalid room name');
+        }
+        packed[index + axis] = coord;
+    }
+    if (ii !== roomName.length) {
+        throw new Error('Invalid room name');
+    }
+}
 
-    let terrainData = [];
-    rooms.forEach(function(room) {
-        let pack = new Uint8Array(50 * 50 / 4);
+//
+// Packs `{ room, terrain }` entries into the 2 bits per tile format the native module uses. Rooms
+// with no terrain are passed as `bits: null`
+function packTerrain(rooms) {
+    return _.map(rooms, function(room) {
         let terrain = room.terrain;
+        if (!terrain) {
+            return { room: parseRoomName(room.room), bits: null };
+        }
+        let pack = new Uint8Array(50 * 50 / 4);
         for (let xx = 0; xx < 50; ++xx) {
             for (let yy = 0; yy < 50; ++yy) {
                 let ii = xx * 50 + yy;
@@ -33,19 +64,60 @@ exports.init = function init(mod, rooms) {
                 pack[ii / 4 | 0] = pack[ii / 4 | 0] & ~(0x03 << ii % 4 * 2) | bit << ii % 4 * 2;
             }
         }
-        terrainData.push({
+        return {
             room: parseRoomName(room.room),
             bits: pack,
-        });
+        };
     });
+}
+
+exports.init = function init(mod, rooms) {
+
+    let terrainData = packTerrain(rooms);
 
-    if (mod.version !== 11) {
+    if (mod.version !== 25) {
         throw new Error('Invalid pathfinder binary');
     }
     mod.loadTerrain(terrainData);
 };
 
-module.exports.create = function create(mod) {
+//
+// Adds or replaces terrain for some rooms without reloading the whole map, e.g. when new rooms are
+// opened. Rooms with a null `terrain` are removed. Searches already running keep the old terrain.
+exports.updateTerrain = function updateTerrain(mod, rooms) {
+    mod.loadTerrain(packTerrain(rooms));
+};
+
+//
+// Records a sample of every search in this process to `path` so slow ones can be run again with the
+// native `replay` tool. `options.sampleRate` is the fraction of searches kept (default 0.01) and
+// recording stops by itself once the file reaches `options.maxBytes` (default 64mb).
+exports.startTrace = function startTrace(mod, path, options) {
+    options = options || {};
+    mod.startTrace(
+        String(path),
+        options.maxBytes === undefined ? 64 * 1024 * 1024 : Number(options.maxBytes),
+        options.sampleRate === undefined ? 0.01 : Number(options.sampleRate)
+    );
+};
+
+exports.stopTrace = function stopTrace(mod) {
+    mod.stopTrace();
+};
+
+//
+// Path finders kept by the calling thread for searches started from inside a room callback:
+// `{ size, inUse, peakInUse, allocations, trimmed }`. `allocations` only goes up with deeper recursion
+// than seen before, or after idle path finders were `trimmed`.
+exports.getPoolStats = function getPoolStats(mod) {
+    return mod.getPoolStats();
+};
+
+//
+// `limits.maxRooms` raises the cap on `options.maxRooms` past the in-game default of 64 for server-side
+// tooling. The native module grows its storage on demand, up to 1024 rooms.
+module.exports.create = function create(mod, limits) {
+    let maxRoomsLimit = Math.min(1024, Math.max(1, (limits && limits.maxRooms | 0) || 64));
 //
 // Converts return value of `parseRoomName` back into a normal room name
     function generateRoomName(xx, yy) {
@@ -55,18 +127,15 @@ module.exports.create = function create(mod) {
         );
     }
 //
-// Helper function to convert RoomPosition objects into global coordinate objects
-    function toWorldPosition(rp) {
-
+// Converts a RoomPosition into global coordinates, written as xx, yy into `packed` at `index`
+    function packWorldPosition(rp, packed, index) {
         let xx = rp.x | 0, yy = rp.y | 0;
         if (!(xx >=0 && xx < 50 && yy >= 0 && yy < 50)) {
             throw new Error('Invalid room position');
         }
-        let offset = parseRoomName(rp.roomName);
-        return {
-            xx: xx + offset.xx * 50,
-            yy: yy + offset.yy * 50,
-        };
+        packRoomName(rp.roomName, packed, index);
+        packed[index] = packed[index] * 50 + xx;
+        packed[index + 1] = packed[index + 1] * 50 + yy;
     }
 
 //
@@ -79,67 +148,233 @@ module.exports.create = function create(mod) {
         );
     }
 
+//
+// Native CostMatrix with bulk operations. Data is laid out the same as the JS CostMatrix and is passed
+// to the search without a copy.
+    class CostMatrix extends mod.CostMatrix {
+        addTerrain(roomName, plainCost, swampCost, wallCost) {
+            super.addTerrain(parseRoomName(roomName), plainCost | 0, swampCost | 0, wallCost === undefined ? 255 : wallCost | 0);
+            return this;
+        }
+    }
+
+//
+// Native CostMatrix objects are handed over as-is, JS ones by their underlying data
+    function costMatrixData(costMatrix) {
+        return costMatrix instanceof mod.CostMatrix ? costMatrix : costMatrix._bits;
+    }
+
     const make = function (_globals) {
         globals = _globals;
     };
 
-    const search = function (origin, goal, options) {
+    //
+    // Normalizes options and goals into the arguments `mod.search` expects. The room callback slot is
+    // left empty for the caller to fill in.
+    function searchArgs(origin, goal, options) {
 
         // Options
-        options = options || {};
         let plainCost = Math.min(254, Math.max(1, (options.plainCost | 0) || 1));
         let swampCost = Math.min(254, Math.max(1, (options.swampCost | 0) || 5));
         let heuristicWeight = Math.min(9, Math.max(1, options.heuristicWeight || 1.2));
         let maxOps = Math.max(1, (options.maxOps | 0) || 2000);
         let maxCost = Math.max(1, (options.maxCost | 0) || 0xffffffff);
-        let maxRooms = Math.min(64, Math.max(1, (options.maxRooms | 0) || 16));
+        let maxRooms = Math.min(maxRoomsLimit, Math.max(1, (options.maxRooms | 0) || 16));
         let flee = !!options.flee;
+        // MOVE parts per part that generates fatigue. Costs become ticks per move for a creep with that
+        // body, and CostMatrix values are fatigue factors: 1 for roads, 2 plains, 10 swamps.
+        let moveRatio = Math.min(1000, Math.max(0, Number(options.moveRatio) || 0));
 
-        // Convert one-or-many goal into standard format for native extension
-        let goals = _.map(Array.isArray(goal) ? goal : [ goal ], function(goal) {
+        // Pack the origin and one-or-many goal into [ xx, yy, then xx, yy, range for each goal ], which
+        // the native extension reads without any property lookups
+        let goals = Array.isArray(goal) ? goal : [ goal ];
+        let packed = new Uint32Array(2 + goals.length * 3);
+        packWorldPosition(origin, packed, 0);
+        for (let ii = 0; ii < goals.length; ++ii) {
+            let goal = goals[ii];
             if (goal.x !== undefined && goal.y !== undefined && goal.roomName !== undefined) {
-                return {
-                    range: 0,
-                    pos: toWorldPosition(goal),
-                };
+                packWorldPosition(goal, packed, 2 + ii * 3);
             } else {
-                let range = Math.max(0, goal.range | 0);
-                return {
-                    range: range,
-                    pos: toWorldPosition(goal.pos),
-                };
+                packWorldPosition(goal.pos, packed, 2 + ii * 3);
+                packed[4 + ii * 3] = Math.max(0, goal.range | 0);
             }
-        });
+        }
 
-        // Setup room callback
-        let cb = options.roomCallback;
-        if (cb) {
-            if (typeof cb !== 'function') {
-                cb = undefined;
-            } else {
-                cb = function(cb) {
-                    return function(xx, yy) {
-                        let ret = cb(generateRoomName(xx, yy));
-                        if (ret === false) {
-                            return ret;
-                        } else if (ret) {
-                            return ret._bits;
-                        }
-                    };
-                }(cb);
-            }
+        return [ packed, undefined, undefined, plainCost, swampCost, maxRooms, maxOps, maxCost, flee, heuristicWeight, false, !!options.serialize, moveRatio ];
+    }
+
+//
+// Builds the flat room list for searches which don't call back into JS. With `options.route` (room
+// names, or the result of `Game.map.findRoute`) the search is restricted to the origin room plus the
+// route, and `options.roomCallback` is invoked once for each of those rooms up front. Otherwise
+// `options.costMatrices` (object or Map of room name -> CostMatrix | false) is used as-is and other
+// rooms use terrain only.
+    function roomList(origin, options) {
+        let rooms = [];
+        let costMatrices = options.costMatrices instanceof Map ? options.costMatrices : new Map(_.pairs(options.costMatrices || {}));
+        let push = function(roomName, costMatrix) {
+            let room = parseRoomName(roomName);
+            rooms.push(room.xx, room.yy, costMatrix === false ? false : (costMatrix ? costMatrixData(costMatrix) : undefined));
+        };
+        if (options.route) {
+            let cb = typeof options.roomCallback === 'function' ? options.roomCallback : undefined;
+            let roomNames = [ origin.roomName ].concat(_.map(options.route, step => typeof step === 'string' ? step : step.room));
+            _.forEach(_.uniq(roomNames), function(roomName) {
+                push(roomName, costMatrices.has(roomName) ? costMatrices.get(roomName) : (cb ? cb(roomName) : undefined));
+            });
+            return { rooms, restricted: true };
         }
+        costMatrices.forEach(function(costMatrix, roomName) {
+            push(roomName, costMatrix);
+        });
+        return { rooms, restricted: false };
+    }
 
-        // Invoke native code
-        let ret = mod.search(toWorldPosition(origin), goals, cb, plainCost, swampCost, maxRooms, maxOps, maxCost, flee, heuristicWeight);
+//
+// Converts the native return value into what the user sees. With `options.serialize` the path is an
+// array of `{ roomName, path }` per room, where `path` is in the format of `Room.serializePath`: "xxyy"
+// of the first step in that room followed by the direction into each of its steps.
+    function searchResult(ret, serialize) {
         if (ret === undefined) {
             return { path: [], ops: 0, cost: 0, incomplete: false };
         } else if (ret === -1) {
             return { path: [], ops: 0, cost: 0, incomplete: true };
         }
-        ret.path = ret.path.map(fromWorldPosition).reverse();
+        if (serialize) {
+            let path = [];
+            for (let ii = 0; ii < ret.path.length; ii += 3) {
+                path.push({ roomName: generateRoomName(ret.path[ii], ret.path[ii + 1]), path: ret.path[ii + 2] });
+            }
+            ret.path = path;
+        } else {
+            ret.path = ret.path.map(fromWorldPosition).reverse();
+        }
         return ret;
+    }
+
+    const search = function (origin, goal, options) {
+
+        options = options || {};
+        let args = searchArgs(origin, goal, options);
+
+        if (options.route || options.costMatrices) {
+            // Everything is known up front, the native search won't call back into JS
+            let list = roomList(origin, options);
+            args[2] = list.rooms;
+            args[10] = list.restricted;
+        } else {
+            // Setup room callback
+            let cb = options.roomCallback;
+            if (cb) {
+                if (typeof cb !== 'function') {
+                    cb = undefined;
+                } else {
+                    cb = function(cb) {
+                        return function(xx, yy) {
+                            let ret = cb(generateRoomName(xx, yy));
+                            if (ret === false) {
+                                return ret;
+                            } else if (ret) {
+                                return costMatrixData(ret);
+                            }
+                        };
+                    }(cb);
+                }
+            }
+            args[2] = cb;
+
+            // With `options.prefetchRooms: true` the native search guesses which rooms it will enter
+            // from the exits between rooms and asks for all of them at once, saving a trip out of native
+            // code per room. The guess may include rooms the search never enters, so `roomCallback` can
+            // run for those too.
+            if (cb && options.prefetchRooms === true) {
+                args[13] = function(rooms) {
+                    let ret = new Array(rooms.length >> 1);
+                    for (let ii = 0; ii < ret.length; ++ii) {
+                        ret[ii] = cb(rooms[ii * 2], rooms[ii * 2 + 1]);
+                    }
+                    return ret;
+                };
+            }
+        }
+
+        // Invoke native code
+        return searchResult(mod.search.apply(mod, args), args[11]);
+    };
+
+//
+// Runs many independent searches in parallel on native worker threads. Each request is
+// `{ origin, goal, options }` where `options` takes the same values as `search`. Room callbacks are
+// only used together with `options.route`, otherwise rooms come from `options.costMatrices`.
+// CostMatrix data is copied before the searches start. Not available inside player runtimes.
+    const searchBatch = function (requests) {
+        let searches = _.map(requests, function(request) {
+            let options = request.options || {};
+            let args = searchArgs(request.origin, request.goal, options);
+            let list = roomList(request.origin, options);
+            args[2] = list.rooms;
+            args[10] = list.restricted;
+            return args;
+        });
+        return _.map(mod.searchBatch(searches), (ret, ii) => searchResult(ret, searches[ii][11]));
     };
 
-    return {make, search};
+//
+// Plans paths for a group of creeps so they don't walk into each other. `requests` is
+// `[{ origin, goal }, ...]` in priority order and `options` is shared by all of them, with rooms from
+// `options.costMatrices` or `options.route` as in `searchBatch`. The first `options.window` (default 8,
+// up to 64) steps of each path avoid the creeps before it, so plan again within that many ticks. The
+// same position twice in a row means wait a tick there. Results are the same as `search` plus
+// `cooperative`, which is false if a creep couldn't be fit around the others and got a regular path,
+// or is staying where it is but another creep had to be given a path through its tile.
+// Not available inside player runtimes.
+    const searchCooperative = function (requests, options) {
+        options = _.extend({}, options, { serialize: false });
+        if (!requests.length) {
+            return [];
+        }
+        let agents = _.map(requests, function(request) {
+            let args = searchArgs(request.origin, request.goal, options);
+            return [ args[0], args[1] ];
+        });
+        let args = searchArgs(requests[0].origin, requests[0].goal, options);
+        let list = roomList(requests[0].origin, options);
+        let window = Math.min(64, Math.max(1, (options.window | 0) || 8));
+        let rets = mod.searchCooperative(agents, list.rooms, args[3], args[4], args[5], args[6], args[7], args[8], args[9], list.restricted, window, args[12]);
+        return _.map(rets, function(ret) {
+            let result = searchResult(ret, false);
+            // Only result objects were planned and reserved, an aborted or failed search wasn't
+            if (typeof ret !== 'object') {
+                result.cooperative = false;
+            }
+            return result;
+        });
+    };
+
+//
+// Terrain queries for planners. Rectangles are inclusive and default to the whole room, results
+// are stored [xx][yy] as in CostMatrix data. 0 is plain, 1 is wall and 2 is swamp.
+    const getTerrain = function (roomName, x1, y1, x2, y2) {
+        return mod.getTerrain(parseRoomName(roomName), x1, y1, x2, y2);
+    };
+
+    const countTerrain = function (roomName, x1, y1, x2, y2) {
+        return mod.countTerrain(parseRoomName(roomName), x1, y1, x2, y2);
+    };
+
+//
+// Distance from each tile to the nearest wall or room edge as a Uint8Array(2500), chessboard by
+// default or Euclidean (rounded down) if `euclidean` is set.
+    const distanceTransform = function (roomName, euclidean) {
+        return mod.distanceTransform(parseRoomName(roomName), !!euclidean);
+    };
+
+    let pathFinder = {make, search, CostMatrix, getTerrain, countTerrain, distanceTransform};
+    // Bulk searches aren't charged to a player's CPU and can't be stopped with their isolate, so the
+    // native module only has them outside of player runtimes
+    if (mod.searchBatch) {
+        pathFinder.searchBatch = searchBatch;
+        pathFinder.searchCooperative = searchCooperative;
+    }
+    return pathFinder;
 };
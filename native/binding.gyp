@@ -1,4 +1,8 @@
 {
+	'variables': {
+		# Also build the `replay` debugging tool: node-gyp configure -- -Dbuild_replay=true
+		'build_replay%': 'false',
+	},
 	'target_defaults': {
 		'default_configuration': 'Release',
 		'configurations': {
@@ -21,6 +25,12 @@
 					'-O3',
 					'-fprofile-use=build/Profile/obj.target/native/src/pf.gcda',
 					'-fprofile-use=build/Profile/obj.target/native/src/main.gcda',
+					'-fprofile-use=build/Profile/obj.target/native/src/batch.gcda',
+					'-fprofile-use=build/Profile/obj.target/native/src/cost_matrix.gcda',
+					'-fprofile-use=build/Profile/obj.target/native/src/terrain.gcda',
+					'-fprofile-use=build/Profile/obj.target/native/src/trace.gcda',
+					'-fprofile-use=build/Profile/obj.target/native/src/coop.gcda',
+					'-fprofile-use=build/Profile/obj.target/native/src/pool.gcda',
 				],
 				'xcode_settings': {
 					'OTHER_CPLUSPLUSFLAGS': [ '-fprofile-use=../_clangprof.profdata' ],
@@ -58,7 +68,45 @@
 			'sources': [
 				'src/main.cc',
 				'src/pf.cc',
+				'src/batch.cc',
+				'src/cost_matrix.cc',
+				'src/terrain.cc',
+				'src/trace.cc',
+				'src/coop.cc',
+				'src/pool.cc',
 			],
 		},
 	],
+	'conditions': [
+		[ 'build_replay == "true"', {
+			'targets': [
+				{
+					# Runs searches recorded with `startTrace` outside of node: build/Release/replay <trace file>
+					'target_name': 'replay',
+					'type': 'executable',
+					'cflags_cc': [ '-std=c++14', '-g' ],
+					'cflags_cc!': [ '-fno-exceptions' ],
+					'xcode_settings': {
+						'GCC_ENABLE_CPP_EXCEPTIONS': 'YES',
+						'GCC_GENERATE_DEBUGGING_SYMBOLS': 'YES',
+						'CLANG_CXX_LANGUAGE_STANDARD': 'c++14',
+					},
+					'msvs_settings': {
+						'VCCLCompilerTool': {
+							'ExceptionHandling': '1',
+						},
+					},
+					'cflags!': [ '-fno-exceptions' ],
+					'conditions': [
+						[ 'OS == "win"', { 'defines': ['NOMINMAX'] } ],
+					],
+					'sources': [
+						'src/replay.cc',
+						'src/pf.cc',
+						'src/trace.cc',
+					],
+				},
+			],
+		} ],
+	],
 }
@@ -103,4 +103,615 @@ if (checksum !== 11843305) {
 	console.error('Incorrect results!');
 	process.exit(1);
 }
-console.log(time[0] + time[1] / 1e9);
+
+// Same searches through road-heavy bases, where each room has a busy CostMatrix and is expanded with
+// A* instead of JPS
+let baseMatrix = new Uint8Array(2500);
+for (let xx = 8; xx < 42; ++xx) {
+	for (let yy = 8; yy < 42; ++yy) {
+		if (xx % 4 === 0 || yy % 4 === 0 || xx === yy) {
+			baseMatrix[xx * 50 + yy] = 1;
+		} else if ((xx * 7 + yy * 13) % 3 === 0) {
+			baseMatrix[xx * 50 + yy] = 0xff;
+		}
+	}
+}
+let roadStart = process.hrtime();
+for (let ii = 0; ii < positions.length; ++ii) {
+	for (let jj = 0; jj < positions.length; ++jj) {
+		if (ii === jj) continue;
+		mod.search(
+			positions[ii],
+			[ { range: 1, pos: positions[jj] } ],
+			function() {
+				return baseMatrix;
+			},
+			2, 10,
+			16, 100000, 100000,
+			0,
+			1.2
+		);
+	}
+}
+let roadTime = process.hrtime(roadStart);
+
+// Behaviour checks for the rest of the module. They only print on failure so the timing above stays
+// the only output for `run-pgo`.
+function check(name, ok) {
+	if (!ok) {
+		console.error(`Check failed: ${name}`);
+		process.exit(1);
+	}
+}
+
+// Searches `from` -> `to` with range 0 through terrain only, extra arguments are appended
+function searchTerrain(from, to, ...extra) {
+	return mod.search(from, [ { range: 0, pos: to } ], undefined, 1, 5, 16, 100000, 100000, 0, 1, false, ...extra);
+}
+
+// Room callback which returns the same as a flat [ xx, yy, CostMatrix | false | undefined, ... ] list
+function roomCallback(rooms) {
+	return function(xx, yy) {
+		for (let ii = 0; ii < rooms.length; ii += 3) {
+			if (rooms[ii] === xx && rooms[ii + 1] === yy) {
+				return rooms[ii + 2];
+			}
+		}
+	};
+}
+
+// Terrain masks of a room in the sample, decoded from the packed data instead of the module
+function sampleTerrain(room) {
+	let bits = require('./sample-terrain').find(info => info.room.xx === room.xx && info.room.yy === room.yy).bits;
+	let terrain = new Uint8Array(2500);
+	for (let ii = 0; ii < 2500; ++ii) {
+		terrain[ii] = bits[ii >> 2] >> (ii % 4 * 2) & 0x03;
+	}
+	return terrain;
+}
+
+// CostMatrix data for the checks, a grid of roads with some walls in between
+let checkMatrix = new Uint8Array(2500);
+for (let ii = 0; ii < 2500; ++ii) {
+	let xx = ii / 50 | 0, yy = ii % 50;
+	checkMatrix[ii] = xx % 5 === 0 || yy % 5 === 0 ? 1 : (xx * 3 + yy) % 7 === 0 ? 0xff : 0;
+}
+
+function roomOf(pos) {
+	return { xx: pos.xx / 50 | 0, yy: pos.yy / 50 | 0 };
+}
+
+// Batched searches return the same as running each one on its own
+{
+	let searches = [];
+	for (let ii = 0; ii < 8; ++ii) {
+		let room = roomOf(positions[ii]);
+		let rooms = [ room.xx, room.yy, checkMatrix, room.xx + 1, room.yy, false ];
+		searches.push([ positions[ii], [ { range: 1, pos: positions[ii + 8] } ], rooms, 2, 10, 16, 100000, 100000, 0, 1.2, false, ii % 2 === 0, ii % 3 ]);
+	}
+	let ret = mod.searchBatch(searches);
+	check('batch', searches.every((args, ii) => {
+		let single = args.slice();
+		single[2] = roomCallback(args[2]);
+		return JSON.stringify(mod.search(...single)) === JSON.stringify(ret[ii]);
+	}));
+}
+
+// Native CostMatrix operations, and searches treat it the same as its data in a Uint8Array
+{
+	let matrix = new mod.CostMatrix();
+	matrix.set(3, 4, 7);
+	matrix.fillRect(10, 10, 12, 11, 20);
+	matrix.setPacked(new Uint16Array([ 5 * 50 + 6 ]), 9);
+	let other = new mod.CostMatrix();
+	other.set(3, 4, 2);
+	other.set(10, 10, 30);
+	matrix.merge(other);
+	let clone = matrix.clone();
+	matrix.set(0, 0, 1);
+	check('cost matrix set', clone.get(3, 4) === 7 && clone.get(5, 6) === 9 && clone.get(0, 0) === 0);
+	check('cost matrix fillRect', clone.get(12, 11) === 20 && clone.get(13, 11) === 0 && clone.get(10, 12) === 0);
+	check('cost matrix merge', clone.get(10, 10) === 30 && clone.get(11, 10) === 20);
+
+	// A mask of 3 is a wall on a swamp, which costs the same as a wall
+	let room = roomOf(positions[0]);
+	let terrain = sampleTerrain(room);
+	let costs = [ 1, 255, 5, 255 ];
+	let withTerrain = new mod.CostMatrix(checkMatrix);
+	withTerrain.addTerrain(room, 1, 5, 255);
+	let ok = true;
+	for (let ii = 0; ii < 2500; ++ii) {
+		ok = ok && withTerrain.get(ii / 50 | 0, ii % 50) === Math.min(255, checkMatrix[ii] + costs[terrain[ii]]);
+	}
+	check('cost matrix addTerrain', ok);
+
+	let search = matrix => mod.search(positions[0], [ { range: 1, pos: positions[9] } ], () => matrix, 2, 10, 16, 100000, 100000, 0, 1.2);
+	check('cost matrix search', JSON.stringify(search(new mod.CostMatrix(checkMatrix))) === JSON.stringify(search(checkMatrix)));
+}
+
+// CostMatrix.addTerrain checks room coordinates the same as searches do
+{
+	let threw = false;
+	try {
+		new mod.CostMatrix().addTerrain({ xx: 0x10000, yy: 0 }, 1, 5, 255);
+	} catch (err) {
+		threw = err instanceof RangeError;
+	}
+	check('cost matrix addTerrain range', threw);
+}
+
+// A flat list of rooms gives the same results as a room callback returning the same data, and with
+// `restricted` the path never leaves the listed rooms
+{
+	let visited = [];
+	let callback = (xx, yy) => {
+		visited.push(xx, yy, (xx + yy) % 3 === 0 ? false : checkMatrix);
+		return visited[visited.length - 1];
+	};
+	let search = (rooms, restricted) => mod.search(positions[0], [ { range: 1, pos: positions[9] } ], rooms, 2, 10, 16, 100000, 100000, 0, 1.2, restricted);
+	let ret = search(callback, false);
+	check('static rooms', JSON.stringify(search(visited.slice(), false)) === JSON.stringify(ret));
+
+	let home = roomOf(positions[0]);
+	ret = search([ home.xx, home.yy, undefined ], true);
+	check('restricted rooms', ret.path.every(pos => (pos[0] / 50 | 0) === home.xx && (pos[1] / 50 | 0) === home.yy));
+}
+
+// The JS wrapper: `costMatrices` finds the same path as a room callback returning the same matrices,
+// and with `route` the callback is only asked for the origin room and the route
+{
+	// The wrapper's world is 65535 rooms wide, this script's is still 255
+	let shift = (65535 >> 1) - (kWorldSize >> 1);
+	mod.loadTerrain(require('./sample-terrain').map(info => ({
+		room: { xx: info.room.xx + shift, yy: info.room.yy + shift },
+		bits: info.bits.slice(0, 625),
+	})));
+	let pathFinder = require('../lib/path-finder').create(mod);
+	pathFinder.make({ RoomPosition });
+	let origin = new RoomPosition(20, 39, 'W5N3');
+	let goal = { pos: new RoomPosition(11, 36, 'W3N1'), range: 1 };
+	let costMatrices = { W5N3: { _bits: checkMatrix }, W4N2: false };
+	let asked = [];
+	let roomCallback = roomName => {
+		asked.push(roomName);
+		return costMatrices[roomName];
+	};
+	let options = { maxOps: 100000, maxRooms: 16 };
+	let ret = pathFinder.search(origin, goal, Object.assign({ roomCallback }, options));
+	check('lib costMatrices', JSON.stringify(pathFinder.search(origin, goal, Object.assign({ costMatrices }, options))) === JSON.stringify(ret));
+
+	asked = [];
+	let route = [ 'W5N2', 'W5N1', 'W4N1', 'W3N1' ];
+	ret = pathFinder.search(origin, goal, Object.assign({ roomCallback, route: route.map(room => ({ exit: 0, room })) }, options));
+	let allowed = [ origin.roomName ].concat(route);
+	check('lib route', !ret.incomplete && asked.length === allowed.length && asked.every(roomName => allowed.indexOf(roomName) !== -1) &&
+		ret.path.every(pos => allowed.indexOf(pos.roomName) !== -1));
+}
+
+// The wrapper turns a serialized path into one { roomName, path } entry for each room it passes
+{
+	let pathFinder = require('../lib/path-finder').create(mod);
+	pathFinder.make({ RoomPosition });
+	let origin = new RoomPosition(20, 39, 'W5N3');
+	let goal = { pos: new RoomPosition(11, 36, 'W3N1'), range: 1 };
+	let plain = pathFinder.search(origin, goal, { maxOps: 100000 });
+	let serialized = pathFinder.search(origin, goal, { maxOps: 100000, serialize: true });
+	let rooms = [];
+	plain.path.forEach(pos => rooms[rooms.length - 1] === pos.roomName || rooms.push(pos.roomName));
+	check('lib serialize', rooms.length > 1 && serialized.path.every(entry => typeof entry.path === 'string') &&
+		JSON.stringify(serialized.path.map(entry => entry.roomName)) === JSON.stringify(rooms));
+}
+
+// Storage grows past the 64 rooms it used to be fixed at, and an instance which grew still finds the
+// same paths afterwards
+{
+	let normal = () => mod.search(positions[0], [ { range: 1, pos: positions[9] } ], () => checkMatrix, 2, 10, 16, 100000, 100000, 0, 1.2);
+	let before = JSON.stringify(normal());
+	let rooms = maxRooms => {
+		let count = 0;
+		let far = { xx: 200 * 50 + 25, yy: 200 * 50 + 25 };
+		mod.search(positions[0], [ { range: 1, pos: far } ], () => { ++count; }, 1, 5, maxRooms, 10000000, 100000000, 0, 1);
+		return count;
+	};
+	check('more than 64 rooms', rooms(100) > 64 && rooms(64) <= 64);
+	check('rooms after growing', JSON.stringify(normal()) === before);
+}
+
+// Rooms past 255 on either axis are rooms of their own instead of wrapping around onto the sample
+{
+	let home = roomOf(positions[0]);
+	let far = { xx: 1000, yy: 1000 + 256 };
+	let bits = require('./sample-terrain').find(info => info.room.xx === home.xx && info.room.yy === home.yy).bits;
+	mod.loadTerrain([ { room: far, bits: bits.slice(0, 625) } ]);
+	let search = room => mod.search(
+		{ xx: room.xx * 50 + 20, yy: room.yy * 50 + 39 }, [ { range: 0, pos: { xx: room.xx * 50 + 30, yy: room.yy * 50 + 10 } } ],
+		undefined, 1, 5, 1, 100000, 100000, 0, 1);
+	let ret = search(home);
+	let moved = search(far).path.map(pos => [ pos[0] - (far.xx - home.xx) * 50, pos[1] - (far.yy - home.yy) * 50 ]);
+	check('16-bit rooms', ret.path.length > 0 && JSON.stringify(moved) === JSON.stringify(ret.path));
+}
+
+// Coordinates which don't fit throw instead of wrapping onto another room
+{
+	let throws = fn => {
+		try {
+			fn();
+		} catch (err) {
+			return err instanceof RangeError;
+		}
+		return false;
+	};
+	let search = (origin, goals, rooms) => mod.search(origin, goals, rooms, 1, 5, 16, 1000, 1000, 0, 1);
+	let goal = [ { range: 1, pos: positions[1] } ];
+	check('position range', throws(() => search({ xx: 0x10000 * 50, yy: positions[0].yy }, goal)));
+	check('packed range', throws(() => search(new Uint32Array([ positions[0].xx, positions[0].yy, positions[1].xx, 0x10000 * 50, 1 ]))));
+	check('room list range', throws(() => search(positions[0], goal, [ 0x10000, 0, undefined ])));
+}
+
+// Serialized paths decode with `Room.deserializePath` to the same tiles as the plain path
+{
+	const offsets = [ null, [ 0, -1 ], [ 1, -1 ], [ 1, 0 ], [ 1, 1 ], [ 0, 1 ], [ -1, 1 ], [ -1, 0 ], [ -1, -1 ] ];
+	let deserializePath = function(path) {
+		let result = [];
+		let xx = parseInt(path.substr(0, 2)), yy = parseInt(path.substr(2, 2));
+		for (let ii = 4; ii < path.length; ++ii) {
+			let direction = Number(path.charAt(ii));
+			if (ii > 4) {
+				xx += offsets[direction][0];
+				yy += offsets[direction][1];
+			}
+			result.push({ x: xx, y: yy, direction });
+		}
+		return result;
+	};
+	let plain = searchTerrain(positions[0], positions[9]);
+	let serialized = searchTerrain(positions[0], positions[9], true);
+	let decoded = [];
+	for (let ii = 0; ii < serialized.path.length; ii += 3) {
+		for (let step of deserializePath(serialized.path[ii + 2])) {
+			decoded.push([ serialized.path[ii] * 50 + step.x, serialized.path[ii + 1] * 50 + step.y ]);
+		}
+	}
+	check('serialize room count', serialized.path.length > 3);
+	check('serialize round trip', JSON.stringify(decoded) === JSON.stringify(plain.path.slice().reverse()));
+}
+
+// Terrain queries and distance transforms against the same computed from the sample directly. Tiles
+// outside of the room count as walls for the transforms.
+{
+	let room = roomOf(positions[0]);
+	let terrain = sampleTerrain(room);
+	let rect = mod.getTerrain(room, 5, 10, 20, 12);
+	let expected = [], counts = { plain: 0, swamp: 0, wall: 0 };
+	for (let xx = 5; xx <= 20; ++xx) {
+		for (let yy = 10; yy <= 12; ++yy) {
+			let mask = terrain[xx * 50 + yy];
+			expected.push(mask);
+			++counts[mask & 1 ? 'wall' : mask ? 'swamp' : 'plain'];
+		}
+	}
+	check('terrain rect', JSON.stringify(Array.from(rect)) === JSON.stringify(expected));
+	check('terrain count', JSON.stringify(mod.countTerrain(room, 5, 10, 20, 12)) === JSON.stringify(counts));
+
+	let walls = [];
+	for (let xx = -1; xx <= 50; ++xx) {
+		for (let yy = -1; yy <= 50; ++yy) {
+			if (xx < 0 || yy < 0 || xx >= 50 || yy >= 50 || terrain[xx * 50 + yy] & 1) {
+				walls.push([ xx, yy ]);
+			}
+		}
+	}
+	let chessboard = mod.distanceTransform(room, false), euclidean = mod.distanceTransform(room, true);
+	let ok = true;
+	for (let ii = 0; ii < 2500; ++ii) {
+		let xx = ii / 50 | 0, yy = ii % 50;
+		let near = Infinity, nearSquared = Infinity;
+		for (let wall of walls) {
+			let dx = Math.abs(wall[0] - xx), dy = Math.abs(wall[1] - yy);
+			near = Math.min(near, Math.max(dx, dy));
+			nearSquared = Math.min(nearSquared, dx * dx + dy * dy);
+		}
+		ok = ok && chessboard[ii] === near && euclidean[ii] === Math.floor(Math.sqrt(nearSquared));
+	}
+	check('distance transform', ok);
+}
+
+// Terrain replaced while a search is using it only shows up in later searches. Each room callback walls
+// off every room the search already admitted.
+{
+	let search = cb => mod.search(positions[0], [ { range: 1, pos: positions[9] } ], cb, 1, 5, 16, 100000, 100000, 0, 1);
+	let ret = search(() => {});
+	let visited = [];
+	let walls = new Uint8Array(625).fill(0x55);
+	let during = search((xx, yy) => {
+		mod.loadTerrain(visited.map(room => ({ room, bits: walls })));
+		visited.push({ xx, yy });
+	});
+	check('update terrain while searching', visited.length > 1 && JSON.stringify(during) === JSON.stringify(ret));
+	check('update terrain', mod.countTerrain(visited[0]).wall === 2500);
+	let sample = require('./sample-terrain');
+	mod.loadTerrain(visited.map(room => ({
+		room,
+		bits: sample.find(info => info.room.xx === room.xx && info.room.yy === room.yy).bits.slice(0, 625),
+	})));
+	check('restore terrain', JSON.stringify(search(() => {})) === JSON.stringify(ret));
+}
+
+// Terrain can be a view into a bigger buffer, as the sample is, but not shorter than a room
+{
+	let buffer = new Uint8Array(2000).fill(0x55);
+	mod.loadTerrain([ { room: { xx: 202, yy: 202 }, bits: new Uint8Array(buffer.buffer, 1000) } ]);
+	check('terrain views', mod.countTerrain({ xx: 202, yy: 202 }).wall === 2500);
+	let threw = false;
+	try {
+		mod.loadTerrain([ { room: { xx: 202, yy: 202 }, bits: new Uint8Array(624) } ]);
+	} catch (err) {
+		threw = err instanceof TypeError;
+	}
+	check('short terrain', threw);
+}
+
+// Player runtimes get a module without the bulk searches, and the wrapper leaves them out as well
+{
+	let player = Object.assign(Object.create(mod), { searchBatch: undefined, searchCooperative: undefined });
+	let wrapper = require('../lib/path-finder').create(player);
+	check('player wrapper', wrapper.search && !wrapper.searchBatch && !wrapper.searchCooperative);
+	check('main wrapper', require('../lib/path-finder').create(mod).searchBatch !== undefined);
+}
+
+// Errors from inside a search which grew past 64 rooms reach JS as exceptions, and the path finder it
+// used still works after
+{
+	let normal = () => mod.search(positions[0], [ { range: 1, pos: positions[9] } ], () => {}, 1, 5, 16, 100000, 100000, 0, 1);
+	let ret = normal();
+	let rooms = 0, threw = false;
+	try {
+		let far = { xx: 200 * 50 + 25, yy: 200 * 50 + 25 };
+		mod.search(positions[0], [ { range: 1, pos: far } ], () => {
+			if (++rooms > 70) {
+				throw new Error('room callback');
+			}
+		}, 1, 5, 100, 10000000, 100000000, 0, 1);
+	} catch (err) {
+		threw = err.message === 'room callback';
+	}
+	check('search error', threw);
+	check('search after error', JSON.stringify(normal()) === JSON.stringify(ret));
+}
+
+// Traced searches replay to the same results outside of node, when the replay tool was built, and a
+// trace stops growing at its size limit
+{
+	const fs = require('fs');
+	const path = require('path');
+	let file = path.join(require('os').tmpdir(), `path-finder-trace-${process.pid}`);
+	let trace = maxBytes => {
+		mod.startTrace(file, maxBytes, 1);
+		for (let ii = 0; ii < 8; ++ii) {
+			mod.search(positions[ii], [ { range: 1, pos: positions[ii + 8] } ], () => checkMatrix, 2, 10, 16, 100000, 100000, 0, 1.2);
+		}
+		mod.stopTrace();
+		return fs.statSync(file).size;
+	};
+	let size = trace(1 << 30);
+	check('trace limit', size > 0 && trace(size / 2) <= size / 2);
+	trace(1 << 30);
+	let replay = path.join(__dirname, `build/${process.argv[2] || 'Release'}/replay`);
+	if (fs.existsSync(replay)) {
+		let out = require('child_process').execFileSync(replay, [ file ]).toString();
+		check('trace replay', /^8 searches, .*, 0 mismatches$/m.test(out));
+	}
+	fs.unlinkSync(file);
+}
+
+// With moveRatio the cost is ticks per move, the same as flat costs of max(1, ceil(factor / (2 * ratio)))
+// with fatigue factors of 2 for plains, 10 for swamps and 1 for the roads in the matrix
+{
+	let search = (plainCost, swampCost, moveRatio) => mod.search(
+		positions[0], [ { range: 1, pos: positions[9] } ], () => checkMatrix, plainCost, swampCost, 16, 100000, 100000, 0, 1,
+		false, false, moveRatio);
+	check('fatigue half', search(2, 10, 0).cost === search(1, 1, 0.5).cost);
+	check('fatigue double', search(1, 3, 0).cost === search(9, 9, 2).cost);
+}
+
+// Cooperative plans keep agents off each other's tiles for the whole window, including agents which
+// are planned later and are still standing on their start tile
+{
+	let room = (xx, yy, bits) => {
+		mod.loadTerrain([ { room: { xx, yy }, bits } ]);
+		return (x, y) => ({ xx: xx * 50 + x, yy: yy * 50 + y });
+	};
+	let plan = (agents, window) => mod.searchCooperative(
+		agents.map(agent => [ agent[0], [ { pos: agent[1], range: 0 } ] ]),
+		[ agents[0][0].xx / 50 | 0, agents[0][0].yy / 50 | 0, undefined ], 1, 5, 16, 100000, 100000, 0, 1, false, window, 0
+	);
+	let collides = (agents, rets, window) => {
+		let at = (ii, time) => {
+			let path = rets[ii].path.slice().reverse();
+			if (time === 0 || path.length === 0) {
+				return [ agents[ii][0].xx, agents[ii][0].yy ];
+			}
+			return path[Math.min(time, path.length) - 1];
+		};
+		for (let time = 1; time <= window; ++time) {
+			for (let ii = 0; ii < agents.length; ++ii) {
+				for (let jj = ii + 1; jj < agents.length; ++jj) {
+					if (String(at(ii, time)) === String(at(jj, time))) {
+						return true;
+					}
+				}
+			}
+		}
+		return false;
+	};
+
+	// Two agents whose shortest paths reach the same tile at the same time
+	let open = room(200, 200, new Uint8Array(625));
+	let agents = [ [ open(20, 25), open(30, 25) ], [ open(25, 20), open(25, 30) ] ];
+	let rets = plan(agents, 12);
+	check('coop crossing', rets[0].cooperative && rets[1].cooperative && !collides(agents, rets, 12));
+
+	// The first agent's shortest first step is where the second one is parked
+	agents = [ [ open(20, 25), open(30, 25) ], [ open(21, 24), open(21, 24) ] ];
+	rets = plan(agents, 8);
+	check('coop parked agent', rets[0].cooperative && rets[1].cooperative && !collides(agents, rets, 8));
+
+	// No way past in a corridor, neither agent can be coordinated
+	let bits = new Uint8Array(625).fill(0x55);
+	for (let ii = 10 * 50 + 25; ii <= 20 * 50 + 25; ii += 50) {
+		bits[ii >> 2] &= ~(3 << (ii % 4 * 2));
+	}
+	let corridor = room(201, 201, bits);
+	agents = [ [ corridor(10, 25), corridor(20, 25) ], [ corridor(15, 25), corridor(15, 25) ] ];
+	rets = plan(agents, 8);
+	check('coop corridor', !rets[0].cooperative && !rets[1].cooperative);
+}
+
+// Searches started from room callbacks each lease another path finder, and the extra ones are trimmed
+// once the pool has been idle at a lower depth for a while
+{
+	let search = cb => mod.search(positions[0], [ { range: 1, pos: positions[1] } ], cb, 1, 5, 16, 100000, 100000, 0, 1);
+	let inner;
+	let nest = depth => search(() => {
+		if (depth > 1) {
+			nest(depth - 1);
+		} else if (inner === undefined) {
+			inner = mod.getPoolStats();
+		}
+	});
+	let before = mod.getPoolStats();
+	nest(5);
+	let after = mod.getPoolStats();
+	check('pool depth', inner.inUse === before.inUse + 5 && after.inUse === before.inUse && after.size >= 5);
+	for (let ii = 0; ii < 600; ++ii) {
+		search(() => {});
+	}
+	let trimmed = mod.getPoolStats();
+	check('pool trim', trimmed.size < after.size && trimmed.trimmed > after.trimmed);
+}
+
+// Cooperative plans lease their path finder from the pool and return it, also when a room fails to load
+{
+	let before = mod.getPoolStats();
+	let plan = (origin, goal) => mod.searchCooperative(
+		[ [ origin, [ { pos: goal, range: 0 } ] ] ], [], 1, 5, 16, 100000, 100000, 0, 1, false, 8, 0);
+	plan(positions[0], positions[1]);
+	let threw = false;
+	try {
+		plan({ xx: 300 * 50 + 25, yy: 300 * 50 + 25 }, { xx: 300 * 50 + 30, yy: 300 * 50 + 25 });
+	} catch (err) {
+		threw = true;
+	}
+	let after = mod.getPoolStats();
+	check('coop pool', threw && after.inUse === before.inUse && after.size === before.size && after.allocations === before.allocations);
+}
+
+// Fleeing from enough goals to use the precomputed threat field, plus a distant goal with no range
+// which is outside of the field's bounds. It has to be ignored, not written past the end of the field.
+{
+	let origin = positions[0];
+	let goals = [];
+	for (let ii = 0; ii < 10; ++ii) {
+		goals.push({ range: 5, pos: { xx: origin.xx - 5 + ii, yy: origin.yy - 2 + ii % 3 } });
+	}
+	let flee = goals => mod.search(origin, goals, [], 1, 5, 16, 100000, 100000, 1, 1, false);
+	let ret = flee(goals);
+	let end = ret.path[0];
+	check('flee leaves range', goals.every(goal => Math.max(Math.abs(goal.pos.xx - end[0]), Math.abs(goal.pos.yy - end[1])) >= goal.range));
+	check('flee ignores range 0', JSON.stringify(flee(goals.concat([ { range: 0, pos: positions[20] } ]))) === JSON.stringify(ret));
+}
+
+// Rooms handed over up front by the prefetch callback give the same results as asking for each room
+// when the search enters it
+{
+	let prefetched = 0;
+	let search = (ii, withPrefetch) => {
+		let home = roomOf(positions[ii]);
+		let callback = (xx, yy) => (xx + yy) % 3 === 0 && xx !== home.xx ? false : checkMatrix;
+		let prefetch = rooms => {
+			let ret = [];
+			for (let jj = 0; jj < rooms.length; jj += 2) {
+				ret.push(callback(rooms[jj], rooms[jj + 1]));
+			}
+			prefetched += ret.length;
+			return ret;
+		};
+		return mod.search(
+			positions[ii], [ { range: 1, pos: positions[ii + 8] } ], callback, 2, 10, 16, 100000, 100000, 0, 1.2,
+			false, false, 0, withPrefetch ? prefetch : undefined);
+	};
+	let ok = true;
+	for (let ii = 0; ii < 8; ++ii) {
+		ok = ok && JSON.stringify(search(ii, true)) === JSON.stringify(search(ii, false));
+	}
+	check('prefetch', prefetched > 0 && ok);
+}
+
+// Packed input reads the same origin and goals as objects, and rejects arrays of the wrong length
+{
+	let goals = [ { range: 1, pos: positions[3] }, { range: 0, pos: positions[7] } ];
+	let packed = new Uint32Array([ positions[0].xx, positions[0].yy ].concat(...goals.map(goal => [ goal.pos.xx, goal.pos.yy, goal.range ])));
+	let search = (origin, goals) => mod.search(origin, goals, [], 1, 5, 16, 100000, 100000, 0, 1.2, false);
+	let throws = fn => {
+		try {
+			fn();
+		} catch (err) {
+			return err instanceof TypeError;
+		}
+		return false;
+	};
+	check('packed input', JSON.stringify(search(packed)) === JSON.stringify(search(positions[0], goals)));
+	check('packed length', throws(() => search(new Uint32Array(4))));
+}
+
+// The wrapper only hands the native search a prefetch callback with `prefetchRooms: true`, and paths
+// are the same either way
+{
+	let prefetch;
+	let spy = Object.assign(Object.create(mod), {
+		search: function() {
+			prefetch = arguments[13];
+			return mod.search.apply(mod, arguments);
+		},
+	});
+	let pathFinder = require('../lib/path-finder').create(spy);
+	pathFinder.make({ RoomPosition });
+	let origin = new RoomPosition(20, 39, 'W5N3');
+	let goal = { pos: new RoomPosition(11, 36, 'W3N1'), range: 1 };
+	let roomCallback = () => ({ _bits: checkMatrix });
+	let ret = pathFinder.search(origin, goal, { maxOps: 100000, roomCallback });
+	check('lib prefetch default', prefetch === undefined);
+	let prefetched = pathFinder.search(origin, goal, { maxOps: 100000, roomCallback, prefetchRooms: true });
+	check('lib prefetch', typeof prefetch === 'function' && JSON.stringify(prefetched) === JSON.stringify(ret));
+}
+
+// A diagonal trip prefetches the rooms of one shortest route, not every room in the rectangle around
+// the trip, and no more rooms than the search ends up entering
+{
+	let search = (prefetch, callback) => mod.search(
+		positions[0], [ { range: 1, pos: positions[4] } ], callback, 1, 5, 16, 100000, 100000, 0, 1.2,
+		false, false, 0, prefetch);
+	let entered = 0, prefetched = 0;
+	search(undefined, () => { ++entered; });
+	search(rooms => {
+		prefetched += rooms.length / 2;
+		return new Array(rooms.length / 2);
+	}, () => {});
+	let from = roomOf(positions[0]), to = roomOf(positions[4]);
+	let route = Math.abs(from.xx - to.xx) + Math.abs(from.yy - to.yy) + 1;
+	check('prefetch route', prefetched === route && prefetched <= entered);
+}
+
+// The wrapper doesn't mark a cooperative result as reserved when the native search was aborted
+{
+	let aborted = Object.assign(Object.create(mod), { searchCooperative: () => [ undefined, -1 ] });
+	let pathFinder = require('../lib/path-finder').create(aborted);
+	pathFinder.make({ RoomPosition });
+	let requests = [
+		{ origin: new RoomPosition(20, 39, 'W5N3'), goal: new RoomPosition(25, 39, 'W5N3') },
+		{ origin: new RoomPosition(20, 30, 'W5N3'), goal: new RoomPosition(25, 30, 'W5N3') },
+	];
+	check('lib coop aborted', pathFinder.searchCooperative(requests).every(ret => ret.cooperative === false));
+}
+
+console.log(time[0] + roadTime[0] + (time[1] + roadTime[1]) / 1e9);
@@ -0,0 +1,120 @@
+#include "batch.h"
+#include "pool.h"
+#include "trace.h"
+#include <algorithm>
+
+using namespace screeps;
+
+	thread_pool_t::thread_pool_t(size_t size) : queued(0) {
+		for (size_t ii = 0; ii < size; ++ii) {
+			workers.emplace_back(std::make_unique<worker_t>());
+		}
+		for (size_t ii = 0; ii < size; ++ii) {
+			workers[ii]->thread = std::thread([this, ii]() { work(ii); });
+		}
+	}
+
+	thread_pool_t::~thread_pool_t() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& ii : workers) {
+			ii->thread.join();
+		}
+	}
+
+	thread_pool_t& thread_pool_t::shared() {
+		static thread_pool_t pool(std::max<size_t>(1, std::thread::hardware_concurrency()));
+		return pool;
+	}
+
+	// Take a task from the front of our own queue, or steal one from the back of someone else's
+	bool thread_pool_t::take(size_t worker, task_t& task) {
+		{
+			worker_t& self = *workers[worker];
+			std::lock_guard<std::mutex> lock(self.mutex);
+			if (!self.queue.empty()) {
+				task = self.queue.front();
+				self.queue.pop_front();
+				--queued;
+				return true;
+			}
+		}
+		for (size_t ii = 1; ii < workers.size(); ++ii) {
+			worker_t& victim = *workers[(worker + ii) % workers.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.queue.empty()) {
+				task = victim.queue.back();
+				victim.queue.pop_back();
+				--queued;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void thread_pool_t::work(size_t worker) {
+		while (true) {
+			task_t task;
+			if (take(worker, task)) {
+				(*task.run->fn)(task.index);
+				// `run` lives on the caller's stack, so it can't be touched after this lock is released
+				std::lock_guard<std::mutex> lock(task.run->mutex);
+				if (--task.run->remaining == 0) {
+					task.run->done.notify_all();
+				}
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this]() { return stopping || queued > 0; });
+			if (stopping && queued <= 0) {
+				return;
+			}
+		}
+	}
+
+	void thread_pool_t::run(size_t count, const std::function<void(size_t)>& fn) {
+		if (count == 0) {
+			return;
+		}
+		run_t run;
+		run.fn = &fn;
+		run.remaining = count;
+
+		// Deal out contiguous chunks to each worker, stealing evens out the rest
+		for (size_t ii = 0; ii < workers.size(); ++ii) {
+			size_t begin = count * ii / workers.size();
+			size_t end = count * (ii + 1) / workers.size();
+			if (begin == end) {
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(workers[ii]->mutex);
+			for (size_t jj = begin; jj < end; ++jj) {
+				workers[ii]->queue.push_back(task_t{&run, jj});
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queued += count;
+		}
+		wake.notify_all();
+
+		std::unique_lock<std::mutex> lock(run.mutex);
+		run.done.wait(lock, [&run]() { return run.remaining == 0; });
+	}
+
+	void screeps::run_batch(std::vector<batch_job_t>& jobs) {
+		thread_pool_t::shared().run(jobs.size(), [&jobs](size_t index) {
+			batch_job_t& job = jobs[index];
+			// An exception can't leave the worker thread, so allocating a path finder is reported the
+			// same as a failed search. Each worker reuses the path finder from its own pool.
+			try {
+				path_finder_pool_t::lease_t pf = path_finder_pool_t::acquire();
+				trace_t::search(*pf, job.origin, job.goals.data(), job.goals.size(), job.rooms, job.options, job.result);
+			} catch (const std::exception& err) {
+				job.error = err.what();
+			}
+		});
+	}
@@ -0,0 +1,79 @@
+#pragma once
+#include "pf.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace screeps {
+
+	//
+	// One search in a batch. All input data is owned by the job so that it can run without touching
+	// v8.
+	struct batch_job_t {
+		world_position_t origin;
+		std::vector<goal_t> goals;
+		std::vector<uint8_t> cost_matrices; // 2500 bytes per room which has a CostMatrix
+		static_room_provider_t rooms;
+		search_options_t options;
+		search_result_t result;
+		bool serialize = false;
+		std::string error;
+	};
+
+	//
+	// Fixed pool of worker threads. Each worker has its own queue which it pulls from the front of,
+	// and when that runs dry it steals from the back of other workers' queues.
+	class thread_pool_t {
+		private:
+			struct run_t {
+				const std::function<void(size_t)>* fn;
+				std::atomic<size_t> remaining;
+				std::mutex mutex;
+				std::condition_variable done;
+			};
+
+			struct task_t {
+				run_t* run;
+				size_t index;
+			};
+
+			struct worker_t {
+				std::mutex mutex;
+				std::deque<task_t> queue;
+				std::thread thread;
+			};
+
+			std::vector<std::unique_ptr<worker_t>> workers;
+			std::mutex mutex;
+			std::condition_variable wake;
+			std::atomic<ptrdiff_t> queued;
+			bool stopping = false;
+
+			bool take(size_t worker, task_t& task);
+			void work(size_t worker);
+
+		public:
+			explicit thread_pool_t(size_t size);
+			~thread_pool_t();
+			thread_pool_t(const thread_pool_t&) = delete;
+			thread_pool_t& operator=(const thread_pool_t&) = delete;
+
+			size_t size() const {
+				return workers.size();
+			}
+
+			// Runs `fn(0)` through `fn(count - 1)` on the pool and blocks until they're all finished
+			void run(size_t count, const std::function<void(size_t)>& fn);
+
+			// Shared pool, sized to the number of hardware threads. Started on first use.
+			static thread_pool_t& shared();
+	};
+
+	// Runs all jobs on the shared thread pool, each worker using its own path finder
+	void run_batch(std::vector<batch_job_t>& jobs);
+};
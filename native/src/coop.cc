@@ -0,0 +1,216 @@
+#include "coop.h"
+#include "pool.h"
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+
+using namespace screeps;
+
+	// Agents which aren't planned yet could still be standing on their start tile at any time
+	bool coop_planner_t::is_reserved(world_position_t pos, unsigned int time) const {
+		return reserved.count(key(pos, time)) != 0 || waiting.count(pos.id) != 0;
+	}
+
+	// Moves are reserved by their destination tile, and by where they came from so that two agents
+	// can't swap places
+	bool coop_planner_t::is_reserved_move(world_position_t pos, world_position_t next, unsigned int time) const {
+		if (is_reserved(next, time)) {
+			return true;
+		}
+		return pos != next && reserved_moves.count(key(next, time) << 3 | next.direction_to(pos)) != 0;
+	}
+
+	// Returns false if the move conflicts with an earlier reservation, it's reserved either way
+	bool coop_planner_t::reserve(world_position_t pos, world_position_t next, unsigned int time) {
+		bool free = !is_reserved_move(pos, next, time);
+		reserved.insert(key(next, time));
+		if (pos != next) {
+			reserved_moves.insert(key(pos, time) << 3 | pos.direction_to(next));
+		}
+		return free;
+	}
+
+	// Stays on `pos` from `from` through the horizon
+	bool coop_planner_t::hold(world_position_t pos, unsigned int from, unsigned int horizon) {
+		bool free = true;
+		for (unsigned int ii = from; ii <= horizon; ++ii) {
+			free = reserve(pos, pos, ii) && free;
+		}
+		return free;
+	}
+
+	// Space-time A* from `origin` at time 0 to within range of one of `targets` by time `horizon`.
+	// With `park` the agent stays where it arrives, so that tile has to be free until the horizon. On
+	// success `prefix` holds the positions at time 1 through arrival.
+	bool coop_planner_t::plan_window(
+		world_position_t origin, const std::vector<goal_t>& targets, bool park,
+		unsigned int horizon, uint32_t max_ops, cost_t& cost, uint32_t& ops
+	) {
+		typedef std::pair<cost_t, uint64_t> open_t;
+		std::priority_queue<open_t, std::vector<open_t>, std::greater<open_t>> open;
+		auto heuristic = [&](world_position_t pos) -> cost_t {
+			cost_t ret = std::numeric_limits<cost_t>::max();
+			for (auto& target : targets) {
+				cost_t dist = pos.range_to(target.pos);
+				ret = std::min<cost_t>(ret, dist > target.range ? (dist - target.range) * world->heuristic_scale : 0);
+			}
+			return ret;
+		};
+		nodes.clear();
+		prefix.clear();
+		uint64_t start = key(origin, 0);
+		nodes[start] = node_t{start, 0};
+		open.push(open_t(heuristic(origin), start));
+
+		while (!open.empty() && ops < max_ops) {
+			open_t current = open.top();
+			open.pop();
+			world_position_t pos(current.second >> 38, current.second >> 16 & 0x3fffff);
+			unsigned int time = current.second & 0xffff;
+			cost_t g_cost = nodes[current.second].g_cost;
+			if (current.first > g_cost + heuristic(pos)) {
+				// Stale entry, this node was reached more cheaply since
+				continue;
+			}
+			++ops;
+
+			if (heuristic(pos) == 0) {
+				bool free = true;
+				for (unsigned int ii = time + 1; park && free && ii <= horizon; ++ii) {
+					free = !is_reserved(pos, ii);
+				}
+				if (free) {
+					for (uint64_t ii = current.second; ii != start; ii = nodes[ii].parent) {
+						prefix.push_back(world_position_t(ii >> 38, ii >> 16 & 0x3fffff));
+					}
+					std::reverse(prefix.begin(), prefix.end());
+					cost = g_cost;
+					return true;
+				}
+			}
+			if (time == horizon) {
+				continue;
+			}
+
+			// 8 moves, plus waiting where we are. Creeps on an exit tile are moved to the next room at
+			// the end of the tick so they can't wait there.
+			bool on_exit = (pos.xx + 1) % 50 < 2 || (pos.yy + 1) % 50 < 2;
+			for (int dir = world_position_t::TOP; dir <= world_position_t::TOP_LEFT + 1; ++dir) {
+				world_position_t next = pos;
+				cost_t step;
+				if (dir > world_position_t::TOP_LEFT) {
+					if (on_exit) {
+						continue;
+					}
+					step = world->heuristic_scale;
+				} else {
+					next = pos.position_in_direction(static_cast<world_position_t::direction_t>(dir));
+					if (!path_finder_t::is_possible_move(pos, next)) {
+						continue;
+					}
+					step = world->look(next);
+					if (step == path_finder_t::obstacle) {
+						continue;
+					}
+				}
+				if (is_reserved_move(pos, next, time + 1)) {
+					continue;
+				}
+				uint64_t next_key = key(next, time + 1);
+				cost_t next_g_cost = g_cost + step;
+				auto ii = nodes.emplace(next_key, node_t{current.second, next_g_cost});
+				if (!ii.second) {
+					if (ii.first->second.g_cost <= next_g_cost) {
+						continue;
+					}
+					ii.first->second = node_t{current.second, next_g_cost};
+				}
+				open.push(open_t(next_g_cost + heuristic(next), next_key));
+			}
+		}
+		return false;
+	}
+
+	void coop_planner_t::plan(
+		path_finder_t& pf, std::vector<coop_agent_t>& agents,
+		room_provider_t& rooms, const search_options_t& options, unsigned int window
+	) {
+		reserved.clear();
+		reserved_moves.clear();
+		waiting.clear();
+		for (auto& agent : agents) {
+			waiting.insert(agent.origin.id);
+		}
+		path_finder_pool_t::lease_t lease = path_finder_pool_t::acquire();
+		world = &*lease;
+		search_options_t world_options = options;
+		world_options.max_rooms = std::max<room_index_t>(options.max_rooms, k_max_rooms);
+		unsigned int horizon = window * 2;
+
+		std::vector<world_position_t> path;
+		try {
+			world->prepare(rooms, world_options);
+			for (auto& agent : agents) {
+				search_result_t& result = agent.result;
+				agent.cooperative = false;
+				waiting.erase(waiting.find(agent.origin.id));
+				pf.search(agent.origin, agent.goals.data(), agent.goals.size(), rooms, options, result);
+
+				// Agents which aren't going anywhere hold their tile for the whole window. That only works
+				// out if no earlier agent had to be given a path through it.
+				if (result.status != search_result_t::OK && result.status != search_result_t::AT_GOAL) {
+					hold(agent.origin, 1, horizon);
+					continue;
+				}
+				if (result.path.empty()) {
+					agent.cooperative = hold(agent.origin, 1, horizon);
+					continue;
+				}
+
+				// Re-plan the start of the path in space-time, up to the tile `window` steps along it. If
+				// that's the end of the path any tile which reaches the goal will do, in case another agent
+				// is already parked on it.
+				path.assign(result.path.rbegin(), result.path.rend());
+				size_t steps = std::min<size_t>(window, path.size());
+				bool park = steps == path.size();
+				if (park && !options.flee && !result.incomplete) {
+					targets = agent.goals;
+				} else {
+					targets.assign(1, goal_t(path[steps - 1], 0));
+				}
+				cost_t prefix_cost;
+				uint32_t window_ops = 0;
+				bool planned = plan_window(agent.origin, targets, park, horizon, options.max_ops, prefix_cost, window_ops);
+				result.ops += window_ops;
+				if (!planned) {
+					// Keep the regular path, later agents still steer around it
+					for (unsigned int ii = 1; ii <= std::min<size_t>(horizon, path.size()); ++ii) {
+						reserve(ii == 1 ? agent.origin : path[ii - 2], path[ii - 1], ii);
+					}
+					continue;
+				}
+
+				for (size_t ii = 0; ii < steps; ++ii) {
+					result.cost -= world->look(path[ii]);
+				}
+				result.cost += prefix_cost;
+				bool free = true;
+				for (unsigned int ii = 1; ii <= prefix.size(); ++ii) {
+					free = reserve(ii == 1 ? agent.origin : prefix[ii - 2], prefix[ii - 1], ii) && free;
+				}
+				if (park) {
+					free = hold(prefix.back(), prefix.size() + 1, horizon) && free;
+				}
+				result.path.assign(path.rbegin(), path.rend() - steps);
+				result.path.insert(result.path.end(), prefix.rbegin(), prefix.rend());
+				agent.cooperative = free;
+			}
+		} catch (...) {
+			world->trim();
+			world = nullptr;
+			throw;
+		}
+		world->trim();
+		world = nullptr;
+	}
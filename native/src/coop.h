@@ -0,0 +1,63 @@
+#pragma once
+#include "pf.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace screeps {
+
+	//
+	// One creep in a cooperative search. `result` is filled in the same as `path_finder_t::search`,
+	// except the path may have the same position twice in a row where the creep waits a tick.
+	struct coop_agent_t {
+		world_position_t origin;
+		std::vector<goal_t> goals;
+		search_result_t result;
+		bool cooperative = false; // the first `window` steps avoid every other agent's reservations
+	};
+
+	//
+	// Windowed hierarchical cooperative A*. Agents are planned one at a time in priority order. Each
+	// one first gets a regular path, then the first `window` steps of that path are re-planned in
+	// space-time against a reservation table holding every earlier agent's moves, so the result is
+	// free of collisions and swaps for that many ticks. Creeps are expected to plan again within the
+	// window. Waiting is allowed, and an agent may fall up to `window` ticks behind its regular path
+	// before it gives up and keeps the uncoordinated path. Agents which aren't planned yet block their
+	// start tile, since they could still be standing there at any time.
+	class coop_planner_t {
+		private:
+			struct node_t {
+				uint64_t parent;
+				cost_t g_cost;
+			};
+
+			path_finder_t* world = nullptr; // room table and costs for the space-time searches, leased while planning
+			std::unordered_set<uint64_t> reserved;
+			std::unordered_set<uint64_t> reserved_moves;
+			std::unordered_multiset<uint64_t> waiting; // start tiles of agents which aren't planned yet
+			std::unordered_map<uint64_t, node_t> nodes;
+			std::vector<world_position_t> prefix;
+			std::vector<goal_t> targets;
+
+			static uint64_t key(world_position_t pos, unsigned int time) {
+				return uint64_t(pos.xx) << 38 | uint64_t(pos.yy) << 16 | time;
+			}
+
+			bool is_reserved(world_position_t pos, unsigned int time) const;
+			bool is_reserved_move(world_position_t pos, world_position_t next, unsigned int time) const;
+			bool reserve(world_position_t pos, world_position_t next, unsigned int time);
+			bool hold(world_position_t pos, unsigned int from, unsigned int horizon);
+			bool plan_window(
+				world_position_t origin, const std::vector<goal_t>& targets, bool park,
+				unsigned int horizon, uint32_t max_ops, cost_t& cost, uint32_t& ops
+			);
+
+		public:
+			// `pf` runs the regular searches. Every agent loads its rooms from `rooms` again, so it should
+			// be a `static_room_provider_t` rather than one which calls into JS.
+			void plan(
+				path_finder_t& pf, std::vector<coop_agent_t>& agents,
+				room_provider_t& rooms, const search_options_t& options, unsigned int window
+			);
+	};
+};
@@ -0,0 +1,241 @@
+#include "cost_matrix.h"
+#include "js_keys.h"
+#include "js_position.h"
+#include <algorithm>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SCREEPS_SSE2
+#endif
+
+using namespace screeps;
+
+	int cost_matrix_t::tag = 0;
+
+	// Sets every tile in the inclusive rectangle to `value`. Columns are contiguous so each one is a
+	// single memset
+	void cost_matrix_t::fill_rect(uint8_t* data, uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2, uint8_t value) {
+		for (unsigned int xx = x1; xx <= x2; ++xx) {
+			memset(data + xx * 50 + y1, value, y2 - y1 + 1);
+		}
+	}
+
+	// Takes the higher cost of each tile
+	void cost_matrix_t::max_merge(uint8_t* data, const uint8_t* other) {
+		size_t ii = 0;
+#ifdef SCREEPS_SSE2
+		for (; ii + 16 <= 2500; ii += 16) {
+			__m128i lhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + ii));
+			__m128i rhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(other + ii));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(data + ii), _mm_max_epu8(lhs, rhs));
+		}
+#endif
+		for (; ii < 2500; ++ii) {
+			data[ii] = std::max(data[ii], other[ii]);
+		}
+	}
+
+	// Sets each tile in a list of `xx * 50 + yy` indices to `value`
+	void cost_matrix_t::set_packed(uint8_t* data, const uint16_t* indices, size_t count, uint8_t value) {
+		for (size_t ii = 0; ii < count; ++ii) {
+			if (indices[ii] < 2500) {
+				data[indices[ii]] = value;
+			}
+		}
+	}
+
+	// Adds a cost to each tile based on its terrain, saturating at 255 (impassable)
+	void cost_matrix_t::add_terrain(uint8_t* data, const uint8_t* terrain, uint8_t plain_cost, uint8_t swamp_cost, uint8_t wall_cost) {
+		// Expand the 2-bit terrain into one byte per tile, 4 tiles per packed byte
+		uint8_t costs[4] = { plain_cost, wall_cost, swamp_cost, wall_cost };
+		uint8_t expanded[2500];
+		for (size_t ii = 0; ii < 625; ++ii) {
+			uint8_t bits = terrain[ii];
+			expanded[ii * 4] = costs[bits & 0x03];
+			expanded[ii * 4 + 1] = costs[bits >> 2 & 0x03];
+			expanded[ii * 4 + 2] = costs[bits >> 4 & 0x03];
+			expanded[ii * 4 + 3] = costs[bits >> 6 & 0x03];
+		}
+		size_t ii = 0;
+#ifdef SCREEPS_SSE2
+		for (; ii + 16 <= 2500; ii += 16) {
+			__m128i lhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + ii));
+			__m128i rhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(expanded + ii));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(data + ii), _mm_adds_epu8(lhs, rhs));
+		}
+#endif
+		for (; ii < 2500; ++ii) {
+			data[ii] = std::min(255, data[ii] + expanded[ii]);
+		}
+	}
+
+	cost_matrix_t* cost_matrix_t::unwrap(v8::Local<v8::Value> value) {
+		if (!value->IsObject()) {
+			return nullptr;
+		}
+		v8::Local<v8::Object> obj = v8::Local<v8::Object>::Cast(value);
+		if (obj->InternalFieldCount() != 2 || obj->GetAlignedPointerFromInternalField(1) != &tag) {
+			return nullptr;
+		}
+		return Nan::ObjectWrap::Unwrap<cost_matrix_t>(obj);
+	}
+
+	void cost_matrix_t::init(v8::Local<v8::Object> target, v8::Local<v8::Array> keys) {
+		v8::Local<v8::FunctionTemplate> tpl = Nan::New<v8::FunctionTemplate>(js_construct);
+		tpl->SetClassName(Nan::New("CostMatrix").ToLocalChecked());
+		tpl->InstanceTemplate()->SetInternalFieldCount(2);
+		Nan::SetPrototypeMethod(tpl, "get", js_get);
+		Nan::SetPrototypeMethod(tpl, "set", js_set);
+		Nan::SetPrototypeMethod(tpl, "fillRect", js_fill_rect);
+		Nan::SetPrototypeMethod(tpl, "merge", js_merge);
+		Nan::SetPrototypeMethod(tpl, "setPacked", js_set_packed);
+		Nan::SetPrototypeMethod(tpl, "addTerrain", js_add_terrain, keys);
+		Nan::SetPrototypeMethod(tpl, "clone", js_clone);
+		Nan::Set(target, Nan::New("CostMatrix").ToLocalChecked(), Nan::GetFunction(tpl).ToLocalChecked());
+	}
+
+	// Reads a coordinate argument, throws if it's out of range
+	static bool coord_from_js(v8::Local<v8::Value> value, uint8_t& coord) {
+		uint32_t tmp = Nan::To<uint32_t>(value).FromJust();
+		if (tmp >= 50) {
+			Nan::ThrowRangeError("Invalid coordinate");
+			return false;
+		}
+		coord = tmp;
+		return true;
+	}
+
+	static cost_matrix_t* this_from_js(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+		cost_matrix_t* that = cost_matrix_t::unwrap(info.This());
+		if (that == nullptr) {
+			Nan::ThrowTypeError("Not a CostMatrix");
+		}
+		return that;
+	}
+
+	// new CostMatrix([bits]) -- optionally initialized from a 2500 byte typed array
+	NAN_METHOD(cost_matrix_t::js_construct) {
+		if (!info.IsConstructCall()) {
+			Nan::ThrowTypeError("CostMatrix must be called with `new`");
+			return;
+		}
+		cost_matrix_t* that = new cost_matrix_t;
+		if (info.Length() > 0 && info[0]->IsArrayBufferView()) {
+			Nan::TypedArrayContents<uint8_t> bits(info[0]);
+			if (bits.length() == 2500) {
+				memcpy(that->data, *bits, 2500);
+			}
+		}
+		that->Wrap(info.This());
+		info.This()->SetAlignedPointerInInternalField(1, &tag);
+		info.GetReturnValue().Set(info.This());
+	}
+
+	NAN_METHOD(cost_matrix_t::js_get) {
+		cost_matrix_t* that = this_from_js(info);
+		uint8_t xx, yy;
+		if (that == nullptr || !coord_from_js(info[0], xx) || !coord_from_js(info[1], yy)) {
+			return;
+		}
+		info.GetReturnValue().Set(Nan::New(that->data[xx * 50 + yy]));
+	}
+
+	NAN_METHOD(cost_matrix_t::js_set) {
+		cost_matrix_t* that = this_from_js(info);
+		uint8_t xx, yy;
+		if (that == nullptr || !coord_from_js(info[0], xx) || !coord_from_js(info[1], yy)) {
+			return;
+		}
+		that->data[xx * 50 + yy] = Nan::To<uint32_t>(info[2]).FromJust();
+	}
+
+	// fillRect(x1, y1, x2, y2, value), inclusive
+	NAN_METHOD(cost_matrix_t::js_fill_rect) {
+		cost_matrix_t* that = this_from_js(info);
+		uint8_t x1, y1, x2, y2;
+		if (
+			that == nullptr ||
+			!coord_from_js(info[0], x1) || !coord_from_js(info[1], y1) ||
+			!coord_from_js(info[2], x2) || !coord_from_js(info[3], y2)
+		) {
+			return;
+		}
+		if (x1 <= x2 && y1 <= y2) {
+			fill_rect(that->data, x1, y1, x2, y2, Nan::To<uint32_t>(info[4]).FromJust());
+		}
+	}
+
+	// merge(other) -- each tile becomes the higher of the two costs
+	NAN_METHOD(cost_matrix_t::js_merge) {
+		cost_matrix_t* that = this_from_js(info);
+		if (that == nullptr) {
+			return;
+		}
+		cost_matrix_t* other = unwrap(info[0]);
+		if (other == nullptr) {
+			Nan::ThrowTypeError("Not a CostMatrix");
+			return;
+		}
+		max_merge(that->data, other->data);
+	}
+
+	// setPacked(indices, value) -- `indices` is a Uint16Array of `xx * 50 + yy`
+	NAN_METHOD(cost_matrix_t::js_set_packed) {
+		cost_matrix_t* that = this_from_js(info);
+		if (that == nullptr) {
+			return;
+		}
+		if (!info[0]->IsUint16Array()) {
+			Nan::ThrowTypeError("Expected a Uint16Array");
+			return;
+		}
+		Nan::TypedArrayContents<uint16_t> indices(info[0]);
+		set_packed(that->data, *indices, indices.length(), Nan::To<uint32_t>(info[1]).FromJust());
+	}
+
+	// addTerrain(room, plainCost, swampCost, wallCost) -- `room` is { xx, yy } as in `loadTerrain`
+	NAN_METHOD(cost_matrix_t::js_add_terrain) {
+		cost_matrix_t* that = this_from_js(info);
+		if (that == nullptr) {
+			return;
+		}
+		map_position_t pos;
+		if (!map_position_from_js(info[0], js_keys_t(info.Data()), pos)) {
+			return;
+		}
+		terrain_ref_t terrain = path_finder_t::terrain_data(pos);
+		if (terrain == nullptr) {
+			Nan::ThrowError("Could not load terrain data");
+			return;
+		}
+		add_terrain(
+			that->data, terrain.get(),
+			std::min<uint32_t>(255, Nan::To<uint32_t>(info[1]).FromJust()),
+			std::min<uint32_t>(255, Nan::To<uint32_t>(info[2]).FromJust()),
+			std::min<uint32_t>(255, Nan::To<uint32_t>(info[3]).FromJust())
+		);
+	}
+
+	// Goes through `this.constructor` so subclasses clone to the right type
+	NAN_METHOD(cost_matrix_t::js_clone) {
+		cost_matrix_t* that = this_from_js(info);
+		if (that == nullptr) {
+			return;
+		}
+		v8::Local<v8::Value> constructor = Nan::Get(info.This(), Nan::New("constructor").ToLocalChecked()).ToLocalChecked();
+		if (!constructor->IsFunction()) {
+			Nan::ThrowTypeError("Not a CostMatrix");
+			return;
+		}
+		Nan::MaybeLocal<v8::Object> copy_js = Nan::NewInstance(v8::Local<v8::Function>::Cast(constructor), 0, nullptr);
+		if (copy_js.IsEmpty()) {
+			return;
+		}
+		cost_matrix_t* copy = unwrap(copy_js.ToLocalChecked());
+		if (copy == nullptr) {
+			Nan::ThrowTypeError("Not a CostMatrix");
+			return;
+		}
+		memcpy(copy->data, that->data, 2500);
+		info.GetReturnValue().Set(copy_js.ToLocalChecked());
+	}
@@ -0,0 +1,41 @@
+#pragma once
+#include <nan.h>
+#include "pf.h"
+
+namespace screeps {
+
+	//
+	// Native CostMatrix. Data is stored [xx][yy], the same as `room_info_t::cost_matrix`, so the search
+	// can use it directly without a copy.
+	class cost_matrix_t : public Nan::ObjectWrap {
+		public:
+			uint8_t data[2500];
+
+			cost_matrix_t() : data{} {}
+
+			// Bulk operations on raw CostMatrix data
+			static void fill_rect(uint8_t* data, uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2, uint8_t value);
+			static void max_merge(uint8_t* data, const uint8_t* other);
+			static void set_packed(uint8_t* data, const uint16_t* indices, size_t count, uint8_t value);
+			static void add_terrain(uint8_t* data, const uint8_t* terrain, uint8_t plain_cost, uint8_t swamp_cost, uint8_t wall_cost);
+
+			// Returns the CostMatrix wrapped by `value`, or nullptr if it isn't one
+			static cost_matrix_t* unwrap(v8::Local<v8::Value> value);
+
+			// Adds the `CostMatrix` constructor to the module. `keys` is from `js_keys_t::create`.
+			static void init(v8::Local<v8::Object> target, v8::Local<v8::Array> keys);
+
+		private:
+			// Stored in the second internal field to tell our objects apart from anyone else's
+			static int tag;
+
+			static NAN_METHOD(js_construct);
+			static NAN_METHOD(js_get);
+			static NAN_METHOD(js_set);
+			static NAN_METHOD(js_fill_rect);
+			static NAN_METHOD(js_merge);
+			static NAN_METHOD(js_set_packed);
+			static NAN_METHOD(js_add_terrain);
+			static NAN_METHOD(js_clone);
+	};
+};
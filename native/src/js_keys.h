@@ -0,0 +1,39 @@
+#pragma once
+#include <nan.h>
+
+namespace screeps {
+
+	//
+	// Property names read from JS objects. They're created once per context as internalized strings
+	// and handed to each function through its data slot, so a lookup doesn't build and hash a new
+	// string every time. Each key is only fetched from the array the first time it's used, so callers
+	// which never touch a JS object (packed input) don't pay for it.
+	class js_keys_t {
+		public:
+			enum key_t { XX, YY, POS, RANGE, ROOM, BITS, KEY_COUNT };
+
+		private:
+			v8::Local<v8::Array> array;
+			mutable v8::Local<v8::String> keys[KEY_COUNT];
+
+		public:
+			explicit js_keys_t(v8::Local<v8::Value> data) : array(v8::Local<v8::Array>::Cast(data)) {}
+
+			static v8::Local<v8::Array> create(v8::Isolate* isolate) {
+				static const char* names[KEY_COUNT] = { "xx", "yy", "pos", "range", "room", "bits" };
+				v8::Local<v8::Array> array = Nan::New<v8::Array>(KEY_COUNT);
+				for (uint32_t ii = 0; ii < KEY_COUNT; ++ii) {
+					Nan::Set(array, ii, v8::String::NewFromUtf8(isolate, names[ii], v8::NewStringType::kInternalized).ToLocalChecked());
+				}
+				return array;
+			}
+
+			v8::Local<v8::Value> get(v8::Local<v8::Object> obj, key_t key) const {
+				if (keys[key].IsEmpty()) {
+					keys[key] = v8::Local<v8::String>::Cast(Nan::Get(array, key).ToLocalChecked());
+				}
+				return Nan::Get(obj, keys[key]).ToLocalChecked();
+			}
+	};
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <nan.h>
+#include "js_keys.h"
+#include "pf.h"
+
+namespace screeps {
+
+	//
+	// Conversions from JS objects to native types, shared by the search functions and CostMatrix.
+	// Coordinates past what `map_position_t` can hold would wrap around to another room, so they throw
+	// and return false instead.
+	constexpr uint32_t k_map_size = 0x10000; // rooms along each axis
+	constexpr uint32_t k_world_size = k_map_size * 50; // tiles along each axis
+
+	inline bool map_position_from_js(uint32_t xx, uint32_t yy, map_position_t& pos) {
+		if (xx >= k_map_size || yy >= k_map_size) {
+			Nan::ThrowRangeError("Invalid room coordinates");
+			return false;
+		}
+		pos = map_position_t(xx, yy);
+		return true;
+	}
+
+	inline bool map_position_from_js(v8::Local<v8::Value> pos_js, const js_keys_t& keys, map_position_t& pos) {
+		v8::Local<v8::Object> obj = Nan::To<v8::Object>(pos_js).ToLocalChecked();
+		return map_position_from_js(
+			Nan::To<uint32_t>(keys.get(obj, js_keys_t::XX)).FromJust(),
+			Nan::To<uint32_t>(keys.get(obj, js_keys_t::YY)).FromJust(),
+			pos
+		);
+	}
+
+	inline bool world_position_from_js(uint32_t xx, uint32_t yy, world_position_t& pos) {
+		if (xx >= k_world_size || yy >= k_world_size) {
+			Nan::ThrowRangeError("Invalid position");
+			return false;
+		}
+		pos = world_position_t(xx, yy);
+		return true;
+	}
+
+	inline bool world_position_from_js(v8::Local<v8::Value> pos_js, const js_keys_t& keys, world_position_t& pos) {
+		v8::Local<v8::Object> obj = Nan::To<v8::Object>(pos_js).ToLocalChecked();
+		return world_position_from_js(
+			Nan::To<uint32_t>(keys.get(obj, js_keys_t::XX)).FromJust(),
+			Nan::To<uint32_t>(keys.get(obj, js_keys_t::YY)).FromJust(),
+			pos
+		);
+	}
+
+}
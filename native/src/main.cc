@@ -1,63 +1,557 @@
 // Author: Marcel Laverdet <https://github.com/laverdet>
 #include <nan.h>
-#include <array>
 #include <memory>
 #include "pf.h"
+#include "batch.h"
+#include "coop.h"
+#include "pool.h"
+#include "cost_matrix.h"
+#include "js_keys.h"
+#include "js_position.h"
+#include "terrain.h"
+#include "trace.h"
 
 namespace screeps {
 
-	// Init 2 Pathfinders per thread. We do 2 here because sometimes recursive calls to the path
-	// finder are useful. Any more than 2 deep recursion will have to allocate a new path finder at a
-	// cost of 2.16mb(!)
-	thread_local std::array<path_finder_t, 2> path_finders;
-	uint8_t room_info_t::cost_matrix0[2500] = { 0 };
+	// Reads the origin and goals of a search into `goals`, which is cleared first. They're either a
+	// position and an array of { pos, range }, or packed into one Uint32Array in place of the origin
+	// as [ xx, yy, then xx, yy, range for each goal ], which is read without touching any JS objects.
+	// Throws and returns false if the packed array is the wrong length or a position is invalid.
+	bool search_input_from_js(
+		v8::Local<v8::Value> origin_js, v8::Local<v8::Value> goals_js, const js_keys_t& keys,
+		world_position_t& origin, std::vector<goal_t>& goals
+	) {
+		goals.clear();
+		if (origin_js->IsUint32Array()) {
+			Nan::TypedArrayContents<uint32_t> packed(origin_js);
+			if (packed.length() < 2 || (packed.length() - 2) % 3 != 0) {
+				Nan::ThrowTypeError("Invalid packed search input");
+				return false;
+			}
+			const uint32_t* data = *packed;
+			if (!world_position_from_js(data[0], data[1], origin)) {
+				return false;
+			}
+			goals.reserve((packed.length() - 2) / 3);
+			for (size_t ii = 2; ii < packed.length(); ii += 3) {
+				world_position_t pos;
+				if (!world_position_from_js(data[ii], data[ii + 1], pos)) {
+					return false;
+				}
+				goals.push_back(goal_t(pos, data[ii + 2]));
+			}
+			return true;
+		}
+		if (!world_position_from_js(origin_js, keys, origin)) {
+			return false;
+		}
+		v8::Local<v8::Array> array = v8::Local<v8::Array>::Cast(goals_js);
+		goals.reserve(array->Length());
+		for (uint32_t ii = 0; ii < array->Length(); ++ii) {
+			v8::Local<v8::Object> obj = Nan::To<v8::Object>(Nan::Get(array, ii).ToLocalChecked()).ToLocalChecked();
+			world_position_t pos;
+			if (!world_position_from_js(keys.get(obj, js_keys_t::POS), keys, pos)) {
+				return false;
+			}
+			goals.push_back(goal_t(pos, Nan::To<uint32_t>(keys.get(obj, js_keys_t::RANGE)).FromJust()));
+		}
+		return true;
+	}
 
-	NAN_METHOD(search) {
-		// Find an inactive path finder
-		path_finder_t* pf = nullptr;
-		std::unique_ptr<path_finder_t> pf_holder;
-		for (auto& ii : path_finders) {
-			if (!ii.is_in_use()) {
-				pf = &ii;
-				break;
+	// Accepts either a native CostMatrix or any 2500 byte typed array, returns nullptr otherwise
+	uint8_t* cost_matrix_from_js(v8::Local<v8::Value> value) {
+		cost_matrix_t* cost_matrix = cost_matrix_t::unwrap(value);
+		if (cost_matrix != nullptr) {
+			return cost_matrix->data;
+		}
+		Nan::TypedArrayContents<uint8_t> cost_matrix_js(value);
+		if (cost_matrix_js.length() == 2500) {
+			return *cost_matrix_js;
+		}
+		return nullptr;
+	}
+
+	// Reads a flat list of [ xx, yy, CostMatrix | Uint8Array | false | undefined, ... ]. `false` blocks
+	// the room and `undefined` allows it with terrain only. If `storage` is given the CostMatrix data is
+	// copied into it, otherwise the provider points directly at the JS data. Throws and returns false on
+	// invalid room coordinates.
+	bool rooms_from_js(v8::Local<v8::Array> rooms_js, static_room_provider_t& rooms, std::vector<uint8_t>* storage) {
+		uint32_t room_count = rooms_js->Length() / 3;
+		if (storage != nullptr) {
+			storage->resize(room_count * 2500);
+		}
+		for (uint32_t ii = 0; ii < room_count; ++ii) {
+			map_position_t pos;
+			if (!map_position_from_js(
+				Nan::To<uint32_t>(Nan::Get(rooms_js, ii * 3).ToLocalChecked()).FromJust(),
+				Nan::To<uint32_t>(Nan::Get(rooms_js, ii * 3 + 1).ToLocalChecked()).FromJust(),
+				pos
+			)) {
+				return false;
+			}
+			v8::Local<v8::Value> cost_matrix_js = Nan::Get(rooms_js, ii * 3 + 2).ToLocalChecked();
+			if (cost_matrix_js->IsBoolean() && cost_matrix_js->IsFalse()) {
+				rooms.block(pos);
+				continue;
 			}
+			uint8_t* cost_matrix = cost_matrix_from_js(cost_matrix_js);
+			if (cost_matrix != nullptr && storage != nullptr) {
+				memcpy(storage->data() + ii * 2500, cost_matrix, 2500);
+				cost_matrix = storage->data() + ii * 2500;
+			}
+			rooms.add(pos, cost_matrix);
+		}
+		return true;
+	}
+
+	// Arguments 3 through 9 and 12 of `search`, shared with `searchBatch`
+	search_options_t options_from_js(const v8::Local<v8::Value>* args, v8::Local<v8::Value> move_ratio) {
+		search_options_t options;
+		options.plain_cost = Nan::To<uint32_t>(args[0]).FromJust();
+		options.swamp_cost = Nan::To<uint32_t>(args[1]).FromJust();
+		options.max_rooms = Nan::To<uint32_t>(args[2]).FromJust();
+		options.max_ops = Nan::To<uint32_t>(args[3]).FromJust();
+		options.max_cost = Nan::To<uint32_t>(args[4]).FromJust();
+		options.flee = Nan::To<bool>(args[5]).FromJust();
+		options.heuristic_weight = Nan::To<double>(args[6]).FromJust();
+		double ratio = Nan::To<double>(move_ratio).FromJust();
+		options.move_ratio = ratio > 0 ? ratio : 0;
+		return options;
+	}
+
+	// Converts a search result to what `lib/path-finder.js` expects. With `serialize` the path is a
+	// flat list of [ xx, yy, "xxyy123..", ... ] per room instead of one [ xx, yy ] pair per tile.
+	v8::Local<v8::Value> result_to_js(const search_result_t& result, world_position_t origin, bool serialize) {
+		switch (result.status) {
+			case search_result_t::AT_GOAL:
+			case search_result_t::ABORTED:
+				return Nan::Undefined();
+			case search_result_t::INACCESSIBLE:
+				return Nan::New(-1);
+			case search_result_t::OK:
+				break;
 		}
-		if (pf == nullptr) {
-			pf_holder = std::make_unique<path_finder_t>();
-			pf = pf_holder.get();
+		v8::Local<v8::Array> path;
+		if (serialize) {
+			thread_local std::vector<path_segment_t> segments;
+			serialize_path(origin, result, segments);
+			path = Nan::New<v8::Array>(segments.size() * 3);
+			for (uint32_t ii = 0; ii < segments.size(); ++ii) {
+				Nan::Set(path, ii * 3, Nan::New(segments[ii].room.xx));
+				Nan::Set(path, ii * 3 + 1, Nan::New(segments[ii].room.yy));
+				Nan::Set(path, ii * 3 + 2, Nan::New(segments[ii].path).ToLocalChecked());
+			}
+		} else {
+			path = Nan::New<v8::Array>(result.path.size());
+			for (uint32_t ii = 0; ii < result.path.size(); ++ii) {
+				v8::Local<v8::Array> tmp = Nan::New<v8::Array>(2);
+				Nan::Set(tmp, 0, Nan::New(result.path[ii].xx));
+				Nan::Set(tmp, 1, Nan::New(result.path[ii].yy));
+				Nan::Set(path, ii, tmp);
+			}
 		}
+		v8::Local<v8::Object> ret = Nan::New<v8::Object>();
+		Nan::Set(ret, Nan::New("path").ToLocalChecked(), path);
+		Nan::Set(ret, Nan::New("ops").ToLocalChecked(), Nan::New(result.ops));
+		Nan::Set(ret, Nan::New("cost").ToLocalChecked(), Nan::New(result.cost));
+		Nan::Set(ret, Nan::New("incomplete").ToLocalChecked(), Nan::New<v8::Boolean>(result.incomplete));
+		return ret;
+	}
+
+	//
+	// Room provider which invokes the JS room callback each time the search enters a new room. With a
+	// prefetch callback the rooms the search expects to enter are asked for in one call up front, and
+	// the room callback is only used for the rest.
+	class js_room_provider_t : public room_provider_t {
+		private:
+			v8::Isolate* isolate;
+			v8::Local<v8::Function> callback;
+			v8::Local<v8::Function> prefetch_callback;
+			bool has_callback;
+			bool has_prefetch;
+			std::unordered_map<map_position_t, v8::Local<v8::Value>, map_position_t::hash_t> prefetched;
+			// These aren't ever accessed, this is just a place to put the handles for the CostMatrix data
+			// so it doesn't get gc'd
+			std::vector<v8::Local<v8::Value>> room_data_handles;
+
+			// Same as the return value of the room callback
+			bool room_from_js(v8::Local<v8::Value> value, uint8_t*& cost_matrix) {
+				if (value->IsBoolean() && value->IsFalse()) {
+					return false;
+				}
+				room_data_handles.push_back(value);
+				cost_matrix = cost_matrix_from_js(value);
+				return true;
+			}
+
+		public:
+			js_room_provider_t(v8::Local<v8::Value> callback, v8::Local<v8::Value> prefetch_callback) :
+				isolate(v8::Isolate::GetCurrent()),
+				callback(v8::Local<v8::Function>::Cast(callback)),
+				prefetch_callback(v8::Local<v8::Function>::Cast(prefetch_callback)),
+				has_callback(!callback->IsUndefined()),
+				has_prefetch(has_callback && prefetch_callback->IsFunction()) {}
+
+			bool load(map_position_t pos, uint8_t*& cost_matrix) override {
+				cost_matrix = nullptr;
+				if (!has_callback) {
+					return true;
+				}
+				auto ii = prefetched.find(pos);
+				if (ii != prefetched.end()) {
+					v8::Local<v8::Value> value = ii->second;
+					prefetched.erase(ii);
+					return room_from_js(value, cost_matrix);
+				}
+				Nan::TryCatch try_catch;
+				v8::Local<v8::Value> argv[2];
+				argv[0] = Nan::New(pos.xx);
+				argv[1] = Nan::New(pos.yy);
+				Nan::MaybeLocal<v8::Value> ret = Nan::Call(callback, v8::Local<v8::Object>::Cast(Nan::Undefined()), 2, argv);
+				if (try_catch.HasCaught()) {
+					try_catch.ReThrow();
+					throw js_error();
+				}
+				if (!ret.IsEmpty()) {
+					return room_from_js(ret.ToLocalChecked(), cost_matrix);
+				}
+				return true;
+			}
+
+			bool wants_prefetch() override {
+				return has_prefetch;
+			}
+
+			// Calls the prefetch callback with [ xx, yy, ... ], it returns an array of what the room
+			// callback would have returned for each room
+			void prefetch(const std::vector<map_position_t>& rooms) override {
+				Nan::TryCatch try_catch;
+				v8::Local<v8::Array> rooms_js = Nan::New<v8::Array>(rooms.size() * 2);
+				for (uint32_t ii = 0; ii < rooms.size(); ++ii) {
+					Nan::Set(rooms_js, ii * 2, Nan::New(rooms[ii].xx));
+					Nan::Set(rooms_js, ii * 2 + 1, Nan::New(rooms[ii].yy));
+				}
+				v8::Local<v8::Value> argv[1] = { rooms_js };
+				Nan::MaybeLocal<v8::Value> ret = Nan::Call(prefetch_callback, v8::Local<v8::Object>::Cast(Nan::Undefined()), 1, argv);
+				if (try_catch.HasCaught()) {
+					try_catch.ReThrow();
+					throw js_error();
+				}
+				if (ret.IsEmpty() || !ret.ToLocalChecked()->IsArray()) {
+					return;
+				}
+				v8::Local<v8::Array> ret_js = v8::Local<v8::Array>::Cast(ret.ToLocalChecked());
+				uint32_t count = std::min<uint32_t>(rooms.size(), ret_js->Length());
+				for (uint32_t ii = 0; ii < count; ++ii) {
+					prefetched[rooms[ii]] = Nan::Get(ret_js, ii).ToLocalChecked();
+				}
+			}
+
+			bool is_terminating() override {
+				return isolate->IsExecutionTerminating();
+			}
+	};
+
+	//
+	// Room provider for a search with CostMatrix data given up front. Nothing here calls into JS, so
+	// the data can't be moved or collected while the search runs.
+	class js_static_room_provider_t : public static_room_provider_t {
+		private:
+			v8::Isolate* isolate;
+
+		public:
+			js_static_room_provider_t() : isolate(v8::Isolate::GetCurrent()) {}
+
+			bool is_terminating() override {
+				return isolate->IsExecutionTerminating();
+			}
+	};
+
+	// search(origin | packed, goals, roomCallback | rooms, plainCost, swampCost, maxRooms, maxOps, maxCost,
+	//   flee, heuristicWeight, restricted, serialize, moveRatio, prefetchCallback)
+	// `packed` is the origin and goals in one Uint32Array, see `search_input_from_js`. `rooms` is the
+	// same flat list as `rooms_from_js`, in which case the search never calls into JS.
+	// `restricted` blocks every room which isn't in that list. `moveRatio` is `search_options_t::move_ratio`.
+	// `prefetchCallback` is optional, see `js_room_provider_t`.
+	NAN_METHOD(search) {
+		path_finder_pool_t::lease_t pf = path_finder_pool_t::acquire();
 
 		// Get the values from v8 and run the search
-		cost_t plain_cost = Nan::To<uint32_t>(info[3]).FromJust();
-		cost_t swamp_cost = Nan::To<uint32_t>(info[4]).FromJust();
-		uint8_t max_rooms = Nan::To<uint32_t>(info[5]).FromJust();
-		uint32_t max_ops = Nan::To<uint32_t>(info[6]).FromJust();
-		uint32_t max_cost = Nan::To<uint32_t>(info[7]).FromJust();
-		bool flee = Nan::To<bool>(info[8]).FromJust();
-		double heuristic_weight = Nan::To<double>(info[9]).FromJust();
-		info.GetReturnValue().Set(pf->search(
-			info[0], v8::Local<v8::Array>::Cast(info[1]), // origin + goals
-			v8::Local<v8::Function>::Cast(info[2]), // callback
-			plain_cost, swamp_cost,
-			max_rooms, max_ops, max_cost,
-			flee,
-			heuristic_weight
-		));
+		world_position_t origin;
+		std::vector<goal_t>& goals = pf->goal_storage;
+		if (!search_input_from_js(info[0], info[1], js_keys_t(info.Data()), origin, goals)) {
+			return;
+		}
+		v8::Local<v8::Value> args[7] = { info[3], info[4], info[5], info[6], info[7], info[8], info[9] };
+		search_options_t options = options_from_js(args, info[12]);
+		search_result_t result;
+		try {
+			if (info[2]->IsArray()) {
+				js_static_room_provider_t rooms;
+				if (!rooms_from_js(v8::Local<v8::Array>::Cast(info[2]), rooms, nullptr)) {
+					return;
+				}
+				rooms.set_restricted(Nan::To<bool>(info[10]).FromJust());
+				trace_t::search(*pf, origin, goals.data(), goals.size(), rooms, options, result);
+			} else {
+				js_room_provider_t rooms(info[2], info[13]);
+				trace_t::search(*pf, origin, goals.data(), goals.size(), rooms, options, result);
+			}
+		} catch (const std::exception& err) {
+			Nan::ThrowError(err.what());
+			return;
+		}
+		info.GetReturnValue().Set(result_to_js(result, origin, Nan::To<bool>(info[11]).FromJust()));
 	}
 
+	// Takes an array of searches, each one an array of the same arguments as `search` except the room
+	// callback must be a flat list of rooms. The searches are run in parallel with no calls back into
+	// JS.
+	NAN_METHOD(search_batch) {
+		js_keys_t keys(info.Data());
+		v8::Local<v8::Array> searches = v8::Local<v8::Array>::Cast(info[0]);
+		std::vector<batch_job_t> jobs(searches->Length());
+		for (uint32_t ii = 0; ii < jobs.size(); ++ii) {
+			batch_job_t& job = jobs[ii];
+			v8::Local<v8::Array> args = v8::Local<v8::Array>::Cast(Nan::Get(searches, ii).ToLocalChecked());
+			if (!search_input_from_js(Nan::Get(args, 0).ToLocalChecked(), Nan::Get(args, 1).ToLocalChecked(), keys, job.origin, job.goals)) {
+				return;
+			}
+			v8::Local<v8::Value> options[7];
+			for (uint32_t jj = 0; jj < 7; ++jj) {
+				options[jj] = Nan::Get(args, jj + 3).ToLocalChecked();
+			}
+			job.options = options_from_js(options, Nan::Get(args, 12).ToLocalChecked());
+
+			// Snapshot the CostMatrix data since JS can't be trusted to leave it alone while we work
+			if (!rooms_from_js(v8::Local<v8::Array>::Cast(Nan::Get(args, 2).ToLocalChecked()), job.rooms, &job.cost_matrices)) {
+				return;
+			}
+			job.rooms.set_restricted(Nan::To<bool>(Nan::Get(args, 10).ToLocalChecked()).FromJust());
+			job.serialize = Nan::To<bool>(Nan::Get(args, 11).ToLocalChecked()).FromJust();
+		}
+
+		run_batch(jobs);
+
+		v8::Local<v8::Array> ret = Nan::New<v8::Array>(jobs.size());
+		for (uint32_t ii = 0; ii < jobs.size(); ++ii) {
+			if (!jobs[ii].error.empty()) {
+				Nan::ThrowError(jobs[ii].error.c_str());
+				return;
+			}
+			Nan::Set(ret, ii, result_to_js(jobs[ii].result, jobs[ii].origin, jobs[ii].serialize));
+		}
+		info.GetReturnValue().Set(ret);
+	}
+
+	// searchCooperative(agents, rooms, plainCost, swampCost, maxRooms, maxOps, maxCost, flee,
+	//   heuristicWeight, restricted, window, moveRatio)
+	// `agents` is [ [ origin | packed, goals ], ... ] in priority order, see `coop_planner_t`. Returns one result
+	// per agent, same as `search` without `serialize`. Results which avoid the earlier agents have
+	// `cooperative` set.
+	NAN_METHOD(search_cooperative) {
+		thread_local coop_planner_t planner;
+		path_finder_pool_t::lease_t pf = path_finder_pool_t::acquire();
+
+		js_keys_t keys(info.Data());
+		v8::Local<v8::Array> agents_js = v8::Local<v8::Array>::Cast(info[0]);
+		std::vector<coop_agent_t> agents(agents_js->Length());
+		for (uint32_t ii = 0; ii < agents.size(); ++ii) {
+			v8::Local<v8::Array> agent = v8::Local<v8::Array>::Cast(Nan::Get(agents_js, ii).ToLocalChecked());
+			if (!search_input_from_js(Nan::Get(agent, 0).ToLocalChecked(), Nan::Get(agent, 1).ToLocalChecked(), keys, agents[ii].origin, agents[ii].goals)) {
+				return;
+			}
+		}
+		v8::Local<v8::Value> args[7] = { info[2], info[3], info[4], info[5], info[6], info[7], info[8] };
+		search_options_t options = options_from_js(args, info[11]);
+		uint32_t window = std::min(std::max(Nan::To<uint32_t>(info[10]).FromJust(), 1u), 64u);
+		try {
+			js_static_room_provider_t rooms;
+			if (!rooms_from_js(v8::Local<v8::Array>::Cast(info[1]), rooms, nullptr)) {
+				return;
+			}
+			rooms.set_restricted(Nan::To<bool>(info[9]).FromJust());
+			planner.plan(*pf, agents, rooms, options, window);
+		} catch (const std::exception& err) {
+			Nan::ThrowError(err.what());
+			return;
+		}
+
+		v8::Local<v8::Array> ret = Nan::New<v8::Array>(agents.size());
+		for (uint32_t ii = 0; ii < agents.size(); ++ii) {
+			// Agents already at their goal still get a result, to say whether they could keep their tile
+			if (agents[ii].result.status == search_result_t::AT_GOAL) {
+				agents[ii].result.status = search_result_t::OK;
+			}
+			v8::Local<v8::Value> result = result_to_js(agents[ii].result, agents[ii].origin, false);
+			if (result->IsObject()) {
+				Nan::Set(Nan::To<v8::Object>(result).ToLocalChecked(), Nan::New("cooperative").ToLocalChecked(), Nan::New<v8::Boolean>(agents[ii].cooperative));
+			}
+			Nan::Set(ret, ii, result);
+		}
+		info.GetReturnValue().Set(ret);
+	}
+
+	// Terrain query arguments: `room` as { xx, yy } and optionally an inclusive rectangle, which
+	// defaults to the whole room. Throws and returns nullptr on bad input.
+	terrain_ref_t terrain_args_from_js(const Nan::FunctionCallbackInfo<v8::Value>& info, uint8_t rect[4]) {
+		map_position_t room;
+		if (!map_position_from_js(info[0], js_keys_t(info.Data()), room)) {
+			return nullptr;
+		}
+		terrain_ref_t bits = path_finder_t::terrain_data(room);
+		if (bits == nullptr) {
+			Nan::ThrowError("Could not load terrain data");
+			return nullptr;
+		}
+		uint32_t defaults[4] = { 0, 0, 49, 49 };
+		for (int ii = 0; ii < 4; ++ii) {
+			uint32_t value = info[ii + 1]->IsUndefined() ? defaults[ii] : Nan::To<uint32_t>(info[ii + 1]).FromJust();
+			if (value >= 50) {
+				Nan::ThrowRangeError("Invalid coordinate");
+				return nullptr;
+			}
+			rect[ii] = value;
+		}
+		if (rect[0] > rect[2] || rect[1] > rect[3]) {
+			Nan::ThrowRangeError("Invalid rectangle");
+			return nullptr;
+		}
+		return bits;
+	}
+
+	v8::Local<v8::Uint8Array> new_uint8_array(size_t length, uint8_t*& data) {
+		v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(v8::Isolate::GetCurrent(), length);
+		v8::Local<v8::Uint8Array> array = v8::Uint8Array::New(buffer, 0, length);
+		data = *Nan::TypedArrayContents<uint8_t>(array);
+		return array;
+	}
+
+	// getTerrain(room, [x1, y1, x2, y2]) -> Uint8Array of terrain masks stored [xx][yy]
+	NAN_METHOD(get_terrain) {
+		uint8_t rect[4];
+		terrain_ref_t bits = terrain_args_from_js(info, rect);
+		if (bits == nullptr) {
+			return;
+		}
+		uint8_t* data;
+		v8::Local<v8::Uint8Array> ret = new_uint8_array((rect[2] - rect[0] + 1) * (rect[3] - rect[1] + 1), data);
+		terrain_t::get_rect(bits.get(), rect[0], rect[1], rect[2], rect[3], data);
+		info.GetReturnValue().Set(ret);
+	}
+
+	// countTerrain(room, [x1, y1, x2, y2]) -> { plain, swamp, wall }
+	NAN_METHOD(count_terrain) {
+		uint8_t rect[4];
+		terrain_ref_t bits = terrain_args_from_js(info, rect);
+		if (bits == nullptr) {
+			return;
+		}
+		uint32_t counts[3];
+		terrain_t::count_rect(bits.get(), rect[0], rect[1], rect[2], rect[3], counts);
+		v8::Local<v8::Object> ret = Nan::New<v8::Object>();
+		Nan::Set(ret, Nan::New("plain").ToLocalChecked(), Nan::New(counts[terrain_t::PLAIN]));
+		Nan::Set(ret, Nan::New("swamp").ToLocalChecked(), Nan::New(counts[terrain_t::SWAMP]));
+		Nan::Set(ret, Nan::New("wall").ToLocalChecked(), Nan::New(counts[terrain_t::WALL]));
+		info.GetReturnValue().Set(ret);
+	}
+
+	// distanceTransform(room, euclidean) -> Uint8Array(2500) of distance to the nearest wall
+	NAN_METHOD(distance_transform) {
+		map_position_t room;
+		if (!map_position_from_js(info[0], js_keys_t(info.Data()), room)) {
+			return;
+		}
+		terrain_ref_t bits = path_finder_t::terrain_data(room);
+		if (bits == nullptr) {
+			Nan::ThrowError("Could not load terrain data");
+			return;
+		}
+		uint8_t* data;
+		v8::Local<v8::Uint8Array> ret = new_uint8_array(2500, data);
+		if (Nan::To<bool>(info[1]).FromJust()) {
+			terrain_t::distance_transform_euclidean(bits.get(), data);
+		} else {
+			terrain_t::distance_transform_chessboard(bits.get(), data);
+		}
+		info.GetReturnValue().Set(ret);
+	}
+
+	// getPoolStats() -> { size, inUse, peakInUse, allocations, trimmed } for this thread's path finders
+	NAN_METHOD(get_pool_stats) {
+		path_finder_pool_t::stats_t stats = path_finder_pool_t::stats();
+		v8::Local<v8::Object> ret = Nan::New<v8::Object>();
+		Nan::Set(ret, Nan::New("size").ToLocalChecked(), Nan::New<v8::Number>(stats.size));
+		Nan::Set(ret, Nan::New("inUse").ToLocalChecked(), Nan::New<v8::Number>(stats.in_use));
+		Nan::Set(ret, Nan::New("peakInUse").ToLocalChecked(), Nan::New<v8::Number>(stats.peak_in_use));
+		Nan::Set(ret, Nan::New("allocations").ToLocalChecked(), Nan::New<v8::Number>(stats.allocations));
+		Nan::Set(ret, Nan::New("trimmed").ToLocalChecked(), Nan::New<v8::Number>(stats.trimmed));
+		info.GetReturnValue().Set(ret);
+	}
+
+	// startTrace(path, maxBytes, sampleRate) -- records searches for the `replay` tool, see `trace_t`
+	NAN_METHOD(start_trace) {
+		Nan::Utf8String path(info[0]);
+		double max_bytes = Nan::To<double>(info[1]).FromJust();
+		if (!trace_t::start(*path, max_bytes > 0 ? size_t(max_bytes) : 0, Nan::To<double>(info[2]).FromJust())) {
+			Nan::ThrowError("Could not open trace file");
+		}
+	}
+
+	NAN_METHOD(stop_trace) {
+		trace_t::stop();
+	}
+
+	// loadTerrain([{ room, bits }, ...]) -- adds or replaces rooms, or removes them if `bits` is null.
+	// `bits` is read up to its first 625 bytes, so views into one big buffer work.
 	NAN_METHOD(load_terrain) {
-		path_finder_t::load_terrain(v8::Local<v8::Array>::Cast(info[0]));
+		js_keys_t keys(info.Data());
+		v8::Local<v8::Array> terrain = v8::Local<v8::Array>::Cast(info[0]);
+		std::vector<terrain_info_t> rooms;
+		for (uint32_t ii = 0; ii < terrain->Length(); ++ii) {
+			v8::Local<v8::Object> terrain_info = Nan::To<v8::Object>(Nan::Get(terrain, ii).ToLocalChecked()).ToLocalChecked();
+			v8::Local<v8::Value> bits_js = keys.get(terrain_info, js_keys_t::BITS);
+			const uint8_t* bits = nullptr;
+			if (!bits_js->IsNullOrUndefined()) {
+				Nan::TypedArrayContents<uint8_t> contents(bits_js);
+				if (contents.length() < 625) {
+					Nan::ThrowTypeError("Invalid terrain data");
+					return;
+				}
+				bits = *contents;
+			}
+			map_position_t room;
+			if (!map_position_from_js(keys.get(terrain_info, js_keys_t::ROOM), keys, room)) {
+				return;
+			}
+			rooms.push_back(terrain_info_t{ room, bits });
+		}
+		path_finder_t::load_terrain(rooms);
 	}
 };
 
 extern "C" IVM_DLLEXPORT void InitForContext(v8::Isolate* isolate, v8::Local<v8::Context> context, v8::Local<v8::Object> target) {
-	Nan::Set(target, Nan::New("search").ToLocalChecked(), Nan::GetFunction(Nan::New<v8::FunctionTemplate>(screeps::search)).ToLocalChecked());
-	Nan::Set(target, Nan::New("loadTerrain").ToLocalChecked(), Nan::GetFunction(Nan::New<v8::FunctionTemplate>(screeps::load_terrain)).ToLocalChecked());
-	Nan::Set(target, Nan::New("version").ToLocalChecked(), Nan::New<v8::Number>(11));
+	v8::Local<v8::Array> keys = screeps::js_keys_t::create(isolate);
+	Nan::Set(target, Nan::New("search").ToLocalChecked(), Nan::GetFunction(Nan::New<v8::FunctionTemplate>(screeps::search, keys)).ToLocalChecked());
+	Nan::Set(target, Nan::New("getPoolStats").ToLocalChecked(), Nan::GetFunction(Nan::New<v8::FunctionTemplate>(screeps::get_pool_stats)).ToLocalChecked());
+	Nan::Set(target, Nan::New("loadTerrain").ToLocalChecked(), Nan::GetFunction(Nan::New<v8::FunctionTemplate>(screeps::load_terrain, keys)).ToLocalChecked());
+	Nan::Set(target, Nan::New("getTerrain").ToLocalChecked(), Nan::GetFunction(Nan::New<v8::FunctionTemplate>(screeps::get_terrain, keys)).ToLocalChecked());
+	Nan::Set(target, Nan::New("countTerrain").ToLocalChecked(), Nan::GetFunction(Nan::New<v8::FunctionTemplate>(screeps::count_terrain, keys)).ToLocalChecked());
+	Nan::Set(target, Nan::New("distanceTransform").ToLocalChecked(), Nan::GetFunction(Nan::New<v8::FunctionTemplate>(screeps::distance_transform, keys)).ToLocalChecked());
+	screeps::cost_matrix_t::init(target, keys);
+	Nan::Set(target, Nan::New("version").ToLocalChecked(), Nan::New<v8::Number>(25));
 }
 
 NAN_MODULE_INIT(init) {
 	v8::Isolate* isolate = v8::Isolate::GetCurrent();
 	InitForContext(isolate, isolate->GetCurrentContext(), target);
+	v8::Local<v8::Array> keys = screeps::js_keys_t::create(isolate);
+	// Tracing writes files and covers every search in the process, so it's only available from the
+	// main isolate and not to contexts set up through `InitForContext`. The same goes for bulk searches,
+	// which run outside of any player's CPU accounting and don't stop when their isolate is terminated.
+	Nan::Set(target, Nan::New("searchBatch").ToLocalChecked(), Nan::GetFunction(Nan::New<v8::FunctionTemplate>(screeps::search_batch, keys)).ToLocalChecked());
+	Nan::Set(target, Nan::New("searchCooperative").ToLocalChecked(), Nan::GetFunction(Nan::New<v8::FunctionTemplate>(screeps::search_cooperative, keys)).ToLocalChecked());
+	Nan::Set(target, Nan::New("startTrace").ToLocalChecked(), Nan::GetFunction(Nan::New<v8::FunctionTemplate>(screeps::start_trace)).ToLocalChecked());
+	Nan::Set(target, Nan::New("stopTrace").ToLocalChecked(), Nan::GetFunction(Nan::New<v8::FunctionTemplate>(screeps::stop_trace)).ToLocalChecked());
 }
 NODE_MODULE(native, init);
@@ -1,7 +1,9 @@
 // Author: Marcel Laverdet <https://github.com/laverdet>
 #include "pf.h"
+#include "terrain.h"
 #include <iostream>
 #include <algorithm>
+#include <cmath>
 #include <stdexcept>
 
 using namespace screeps;
@@ -16,49 +18,58 @@ constexpr bool is_near_border_pos(T val) {
 	return (val + 2) % 50 < 4;
 }
 
-	decltype(path_finder_t::terrain) path_finder_t::terrain = {{ nullptr }};
+	uint8_t room_info_t::cost_matrix0[2500] = { 0 };
+	decltype(path_finder_t::terrain) path_finder_t::terrain;
+	std::mutex path_finder_t::terrain_mutex;
+
+	// Resize storage for all per-node data to fit `rooms` rooms. Only valid between searches, or when
+	// growing.
+	void path_finder_t::resize(size_t rooms) {
+		room_table.resize(rooms);
+		room_table.shrink_to_fit();
+		parents.resize(rooms * 2500);
+		parents.shrink_to_fit();
+		open_closed.resize(rooms * 2500);
+		heap.resize(rooms * 2500);
+		room_capacity = rooms;
+	}
+
+	// Called when a search finishes. Drops references to terrain and releases the memory from a search
+	// which grew past the in-game room limit
+	void path_finder_t::trim() {
+		pinned_terrain.clear();
+		if (room_capacity > k_max_rooms) {
+			room_indices.clear();
+			room_table_size = 0;
+			resize(k_max_rooms);
+		}
+	}
 
 	// Return room index from a map position, allocates a new room index if needed and possible
 	room_index_t path_finder_t::room_index_from_pos(const map_position_t map_pos) {
-		room_index_t room_index = reverse_room_table[map_pos.id];
-		if (room_index == 0) {
+		room_index_t room_index = room_indices.find(map_pos);
+		if (room_index == room_index_table_t::blocked) {
+			return 0;
+		} else if (room_index == 0) {
 			if (room_table_size >= max_rooms) {
 				return 0;
 			}
-			if (blocked_rooms.find(map_pos) != blocked_rooms.end()) {
-				return 0;
-			}
-			uint8_t* terrain_ptr = terrain[map_pos.id];
+			terrain_ref_t terrain_ptr = terrain_data(map_pos);
 			if (terrain_ptr == nullptr) {
-				Nan::ThrowError("Could not load terrain data");
-				throw js_error();
+				throw std::runtime_error("Could not load terrain data");
 			}
 			uint8_t* cost_matrix = nullptr;
-			if (room_callback != nullptr) {
-				Nan::TryCatch try_catch;
-				v8::Local<v8::Value> argv[2];
-				argv[0] = Nan::New(map_pos.xx);
-				argv[1] = Nan::New(map_pos.yy);
-				Nan::MaybeLocal<v8::Value> ret = Nan::Call(*room_callback, v8::Local<v8::Object>::Cast(Nan::Undefined()), 2, argv);
-				if (try_catch.HasCaught()) {
-					try_catch.ReThrow();
-					throw js_error();
-				}
-				if (!ret.IsEmpty()) {
-					v8::Local<v8::Value> ret_local = ret.ToLocalChecked();
-					if (ret_local->IsBoolean() && ret_local->IsFalse()) {
-						blocked_rooms.insert(map_pos);
-						return 0;
-					}
-					room_data_handles[room_table_size] = ret_local;
-					Nan::TypedArrayContents<uint8_t> cost_matrix_js(room_data_handles[room_table_size]);
-					if (cost_matrix_js.length() == 2500) {
-						cost_matrix = *cost_matrix_js;
-					}
-				}
+			if (!rooms->load(map_pos, cost_matrix)) {
+				room_indices.insert(map_pos, room_index_table_t::blocked);
+				return 0;
 			}
-			room_table[room_table_size++] = room_info_t(terrain_ptr, cost_matrix, map_pos);
-			return reverse_room_table[map_pos.id] = room_table_size;
+			if (room_table_size == room_capacity) {
+				resize(std::min<size_t>(room_capacity * 2, max_rooms));
+			}
+			room_table[room_table_size++] = room_info_t(terrain_ptr.get(), cost_matrix, map_pos);
+			pinned_terrain.push_back(std::move(terrain_ptr));
+			room_indices.insert(map_pos, room_table_size);
+			return room_table_size;
 		}
 		return room_index;
 	}
@@ -112,11 +123,7 @@ constexpr bool is_near_border_pos(T val) {
 		if (terrain.cost_matrix != nullptr) {
 			int tmp = terrain.cost_matrix[pos.xx % 50][pos.yy % 50];
 			if (tmp != 0) {
-				if (tmp == 0xff) {
-					return obstacle;
-				} else {
-					return tmp;
-				}
+				return cost_table[tmp];
 			}
 		}
 		return look_table[terrain.look(pos.xx % 50, pos.yy % 50)];
@@ -125,11 +132,14 @@ constexpr bool is_near_border_pos(T val) {
 	// Returns the minimum Chebyshev distance to a goal
 	cost_t path_finder_t::heuristic(const world_position_t pos) const {
 		if (flee) {
+			if (use_threat_field) {
+				return threat_field.at(pos) * heuristic_scale;
+			}
 			cost_t ret = 0;
 			for (size_t ii = 0; ii < goals.size(); ++ii) {
 				cost_t dist = pos.range_to(goals[ii].pos);
 				if (dist < goals[ii].range) {
-					ret = std::max<cost_t>(ret, goals[ii].range - dist);
+					ret = std::max<cost_t>(ret, (goals[ii].range - dist) * heuristic_scale);
 				}
 			}
 			return ret;
@@ -138,7 +148,7 @@ constexpr bool is_near_border_pos(T val) {
 			for (size_t ii = 0; ii < goals.size(); ++ii) {
 				cost_t dist = pos.range_to(goals[ii].pos);
 				if (dist > goals[ii].range) {
-					ret = std::min<cost_t>(ret, dist - goals[ii].range);
+					ret = std::min<cost_t>(ret, (dist - goals[ii].range) * heuristic_scale);
 				} else {
 					ret = 0;
 				}
@@ -147,36 +157,86 @@ constexpr bool is_near_border_pos(T val) {
 		}
 	}
 
+	// Seeds each goal with its range over the box covering every tile in range of a goal, then the
+	// same two passes as `terrain_t::distance_transform_chessboard` spread them out, losing 1 per tile.
+	// The box has a border of 0 so the passes don't need bounds checks.
+	bool threat_field_t::build(const std::vector<goal_t>& goals) {
+		uint32_t right = 0, bottom = 0;
+		left = top = std::numeric_limits<uint32_t>::max();
+		for (auto& goal : goals) {
+			if (goal.range == 0) {
+				continue;
+			}
+			left = std::min(left, goal.pos.xx - std::min(goal.pos.xx, goal.range));
+			top = std::min(top, goal.pos.yy - std::min(goal.pos.yy, goal.range));
+			right = std::max(right, goal.pos.xx + goal.range);
+			bottom = std::max(bottom, goal.pos.yy + goal.range);
+		}
+		if (left > right) {
+			width = height = 0;
+			return true;
+		}
+		if (uint64_t(right - left + 1) * (bottom - top + 1) > goals.size() * k_threat_field_area) {
+			return false;
+		}
+		width = right - left + 1;
+		height = bottom - top + 1;
+		field.assign(width * height, 0);
+		for (auto& goal : goals) {
+			// Goals with no range aren't in the bounding box, and never add to the heuristic anyway
+			if (goal.range == 0) {
+				continue;
+			}
+			cost_t& value = field[(goal.pos.yy - top) * width + goal.pos.xx - left];
+			value = std::max(value, goal.range);
+		}
+
+		ptrdiff_t stride = width;
+		auto spread = [](cost_t& value, cost_t neighbor) {
+			if (neighbor > value + 1) {
+				value = neighbor - 1;
+			}
+		};
+		for (uint32_t yy = 1; yy < height - 1; ++yy) {
+			for (uint32_t xx = 1; xx < width - 1; ++xx) {
+				cost_t* value = &field[yy * width + xx];
+				spread(*value, value[-1]);
+				spread(*value, value[-stride - 1]);
+				spread(*value, value[-stride]);
+				spread(*value, value[-stride + 1]);
+			}
+		}
+		for (uint32_t yy = height - 2; yy > 0; --yy) {
+			for (uint32_t xx = width - 2; xx > 0; --xx) {
+				cost_t* value = &field[yy * width + xx];
+				spread(*value, value[1]);
+				spread(*value, value[stride + 1]);
+				spread(*value, value[stride]);
+				spread(*value, value[stride - 1]);
+			}
+		}
+		return true;
+	}
+
+	unsigned int room_info_t::count_transitions(const uint8_t* cost_matrix) {
+		unsigned int transitions = 0;
+		for (unsigned int ii = 0; ii < 2500 - 50; ++ii) {
+			transitions += cost_matrix[ii] != cost_matrix[ii + 50];
+		}
+		for (unsigned int ii = 0; ii < 2500; ++ii) {
+			transitions += ii % 50 != 49 && cost_matrix[ii] != cost_matrix[ii + 1];
+		}
+		return transitions;
+	}
+
 	// Run an iteration of basic A*
 	void path_finder_t::astar(pos_index_t index, world_position_t pos, cost_t g_cost) {
 		for (int dir = world_position_t::TOP; dir <= world_position_t::TOP_LEFT; ++dir) {
 			world_position_t neighbor = pos.position_in_direction(static_cast<world_position_t::direction_t>(dir));
 
 			// If this is a portal node there are some moves which will be impossible, and should be discarded
-			if (pos.xx % 50 == 0) {
-				if (neighbor.xx % 50 == 49 && pos.yy != neighbor.yy) {
-					continue;
-				} else if (pos.xx == neighbor.xx) {
-					continue;
-				}
-			} else if (pos.xx % 50 == 49) {
-				if (neighbor.xx % 50 == 0 && pos.yy != neighbor.yy) {
-					continue;
-				} else if (pos.xx == neighbor.xx) {
-					continue;
-				}
-			} else if (pos.yy % 50 == 0) {
-				if (neighbor.yy % 50 == 49 && pos.xx != neighbor.xx) {
-					continue;
-				} else if (pos.yy == neighbor.yy) {
-					continue;
-				}
-			} else if (pos.yy % 50 == 49) {
-				if (neighbor.yy % 50 == 0 && pos.xx != neighbor.xx) {
-					continue;
-				} else if (pos.yy == neighbor.yy) {
-					continue;
-				}
+			if (!is_possible_move(pos, neighbor)) {
+				continue;
 			}
 
 			// Calculate cost of this move
@@ -436,6 +496,59 @@ constexpr bool is_near_border_pos(T val) {
 		}
 	}
 
+	// JPS only pays off when jumps can skip runs of equal cost. Rooms with busy CostMatrices are
+	// classified when they're loaded and use A* instead. Returns whether the expansion counts as an
+	// op: A* nodes which a jump would have passed over are free, so `maxOps` means the same in both.
+	bool path_finder_t::expand(pos_index_t index, world_position_t pos, cost_t g_cost) {
+		if (room_table[index / (50 * 50)].astar) {
+			astar(index, pos, g_cost);
+			return is_jump_point(index, pos);
+		}
+		jps(index, pos, g_cost);
+		return true;
+	}
+
+	// True for A* nodes which a jump from their parent would have stopped at: near a border, a change
+	// in cost, or a forced neighbor. Diagonal moves count unless every neighbor costs the same. Border
+	// tiles return early, so every tile looked at is in the same room.
+	bool path_finder_t::is_jump_point(pos_index_t index, world_position_t pos) const {
+		if (is_near_border_pos(pos.xx) || is_near_border_pos(pos.yy)) {
+			return true;
+		}
+		const room_info_t& room = room_table[index / (50 * 50)];
+		auto look_in_room = [&](world_position_t pos) -> cost_t {
+			uint8_t value = room.cost_matrix[pos.xx % 50][pos.yy % 50];
+			return value != 0 ? cost_table[value] : look_table[room.look(pos.xx % 50, pos.yy % 50)];
+		};
+		world_position_t parent = pos_from_index(parents[index]);
+		cost_t cost = look_in_room(parent);
+		if (look_in_room(pos) != cost) {
+			return true;
+		}
+		int dx = pos.xx > parent.xx ? 1 : (pos.xx < parent.xx ? -1 : 0);
+		int dy = pos.yy > parent.yy ? 1 : (pos.yy < parent.yy ? -1 : 0);
+		if (dx != 0 && dy != 0) {
+			for (int nx = -1; nx <= 1; ++nx) {
+				for (int ny = -1; ny <= 1; ++ny) {
+					if (look_in_room(world_position_t(pos.xx + nx, pos.yy + ny)) != cost) {
+						return true;
+					}
+				}
+			}
+			return false;
+		}
+		for (int side : { -1, 1 }) {
+			int sx = dy * side, sy = dx * side;
+			if (
+				look_in_room(world_position_t(pos.xx + sx, pos.yy + sy)) != obstacle &&
+				look_in_room(world_position_t(parent.xx + sx, parent.yy + sy)) != cost
+			) {
+				return true;
+			}
+		}
+		return false;
+	}
+
 	void path_finder_t::jump_neighbor(world_position_t pos, pos_index_t index, world_position_t neighbor, cost_t g_cost, cost_t cost, cost_t n_cost) {
 		if (n_cost != cost || is_border_pos(neighbor.xx) || is_border_pos(neighbor.yy)) {
 			if (n_cost == obstacle) {
@@ -453,52 +566,172 @@ constexpr bool is_near_border_pos(T val) {
 		push_node(index, neighbor, g_cost);
 	}
 
-	v8::Local<v8::Value> path_finder_t::search(
-		v8::Local<v8::Value> origin_js,
-		v8::Local<v8::Array> goals_js,
-		v8::Local<v8::Function> room_callback,
-		cost_t plain_cost,
-		cost_t swamp_cost,
-		uint8_t max_rooms,
-		uint32_t max_ops,
-		uint32_t max_cost,
-		bool flee,
-		double heuristic_weight
-	) {
-
-		// Clean up from previous iteration
-		for (size_t ii = 0; ii < room_table_size; ++ii) {
-			reverse_room_table[room_table[ii].pos.id] = 0;
+	// Fills in `look_table` and `cost_table`. Normally CostMatrix values are used as-is. With a
+	// `move_ratio` every cost is the ticks a move takes: a creep with W parts which generate fatigue and
+	// M MOVE parts picks up W * factor fatigue per move and sheds 2 * M per tick, so a move takes
+	// max(1, ceil(factor / (2 * ratio))) ticks.
+	void path_finder_t::set_costs(const search_options_t& options) {
+		if (options.move_ratio > 0) {
+			for (int ii = 0; ii < 255; ++ii) {
+				cost_table[ii] = std::max(1.0, std::min<double>(obstacle - 1, std::ceil(ii / (2 * options.move_ratio))));
+			}
+			look_table[0] = cost_table[2];
+			look_table[2] = cost_table[10];
+			heuristic_scale = cost_table[1];
+		} else {
+			for (int ii = 0; ii < 255; ++ii) {
+				cost_table[ii] = ii;
+			}
+			look_table[0] = options.plain_cost;
+			look_table[2] = options.swamp_cost;
+			heuristic_scale = 1;
 		}
+		cost_table[0xff] = obstacle;
+	}
+
+	// Forgets rooms from the last search and sets up costs and the room provider, enough for `look`
+	void path_finder_t::prepare(room_provider_t& rooms, const search_options_t& options) {
+		room_indices.clear();
 		room_table_size = 0;
-		blocked_rooms.clear();
-		goals.clear();
-		open_closed.clear();
-		heap.clear();
+		this->rooms = &rooms;
+		set_costs(options);
+		this->max_rooms = std::min<room_index_t>(options.max_rooms, k_max_rooms_limit);
+	}
 
-		// Construct goal objects
-		for (uint32_t ii = 0; ii < goals_js->Length(); ++ii) {
-			goals.push_back(goal_t(Nan::Get(goals_js, ii).ToLocalChecked()));
+	// Guesses which rooms a search will enter, for `room_provider_t::prefetch`: the first rooms on one
+	// shortest route from the origin to the nearest goal room, moving between rooms through exits.
+	// Leaves `out` empty if there's no route close by, or for flee searches which mostly stay in the
+	// origin room.
+	void path_finder_t::plan_prefetch(world_position_t origin, std::vector<map_position_t>& out) const {
+		// Neighboring rooms indexed the same as the `parents` bits, top right bottom left
+		static constexpr int dx[4] = { 0, 1, 0, -1 }, dy[4] = { -1, 0, 1, 0 };
+		auto has_exit = [](const uint8_t* bits, int dir) {
+			for (unsigned int ii = 1; ii < 49; ++ii) {
+				unsigned int xx = dir == 1 ? 49 : dir == 3 ? 0 : ii;
+				unsigned int yy = dir == 0 ? 0 : dir == 2 ? 49 : ii;
+				if (!(terrain_t::at(bits, xx, yy) & terrain_t::WALL)) {
+					return true;
+				}
+			}
+			return false;
+		};
+		auto neighbors = [&](map_position_t room, auto fn) {
+			terrain_ref_t bits = terrain_data(room);
+			if (bits == nullptr) {
+				return;
+			}
+			for (int dir = 0; dir < 4; ++dir) {
+				map_position_t neighbor(room.xx + dx[dir], room.yy + dy[dir]);
+				if (has_exit(bits.get(), dir) && terrain_data(neighbor) != nullptr) {
+					fn(neighbor, dir);
+				}
+			}
+		};
+
+		out.clear();
+		if (flee) {
+			return;
+		}
+		map_position_t start = origin.map_position();
+
+		// Breadth-first search from the origin room, each room remembers which of its neighbors are one
+		// step closer to the origin
+		struct visit_t {
+			unsigned int depth;
+			uint8_t parents;
+		};
+		std::unordered_map<map_position_t, visit_t, map_position_t::hash_t> visited;
+		auto is_goal = [&](map_position_t room) {
+			for (auto& goal : goals) {
+				if (goal.pos.map_position() == room) {
+					return true;
+				}
+			}
+			return false;
+		};
+		std::vector<map_position_t> frontier{ start }, next, found;
+		visited[start] = visit_t{ 0, 0 };
+		if (is_goal(start)) {
+			found.push_back(start);
+		}
+		for (unsigned int depth = 1; found.empty() && !frontier.empty() && visited.size() < k_prefetch_explore; ++depth) {
+			next.clear();
+			for (auto room : frontier) {
+				neighbors(room, [&](map_position_t neighbor, int dir) {
+					auto ii = visited.emplace(neighbor, visit_t{ depth, 0 });
+					if (ii.first->second.depth != depth) {
+						return;
+					}
+					ii.first->second.parents |= 1 << (dir + 2) % 4;
+					if (ii.second) {
+						next.push_back(neighbor);
+						if (is_goal(neighbor)) {
+							found.push_back(neighbor);
+						}
+					}
+				});
+			}
+			std::swap(frontier, next);
+		}
+		if (found.empty()) {
+			return;
 		}
 
-		// These aren't ever accessed, this is just a place to put the handles for the CostMatrix data
-		// so it doesn't get gc'd
-		v8::Local<v8::Value> room_data_handle_holder[k_max_rooms];
-		room_data_handles = room_data_handle_holder;
-		if (room_callback->IsUndefined()) {
-			this->room_callback = nullptr;
-		} else {
-			this->room_callback = &room_callback;
+		// Walk back from the first goal room found along a single route. Where a room has more than one
+		// parent, take the one closest to the straight line between the origin and goal rooms, which is
+		// where the heuristic pulls the search. Every parent would fill the whole rectangle between them.
+		map_position_t goal = found.front();
+		auto deviation = [&](map_position_t room) {
+			int64_t cross =
+				int64_t(int(room.xx) - int(start.xx)) * (int(goal.yy) - int(start.yy)) -
+				int64_t(int(room.yy) - int(start.yy)) * (int(goal.xx) - int(start.xx));
+			return cross < 0 ? -cross : cross;
+		};
+		out.push_back(goal);
+		while (!(out.back() == start)) {
+			uint8_t parents = visited[out.back()].parents;
+			map_position_t best;
+			int64_t best_deviation = std::numeric_limits<int64_t>::max();
+			for (int dir = 0; dir < 4; ++dir) {
+				map_position_t parent(out.back().xx + dx[dir], out.back().yy + dy[dir]);
+				if (parents & 1 << dir && deviation(parent) < best_deviation) {
+					best = parent;
+					best_deviation = deviation(parent);
+				}
+			}
+			out.push_back(best);
 		}
+		std::reverse(out.begin(), out.end());
+		if (out.size() > std::min<size_t>(max_rooms, k_prefetch_rooms)) {
+			out.resize(std::min<size_t>(max_rooms, k_prefetch_rooms));
+		}
+	}
+
+	void path_finder_t::search(
+		world_position_t origin,
+		const goal_t* goals,
+		size_t goal_count,
+		room_provider_t& rooms,
+		const search_options_t& options,
+		search_result_t& result
+	) {
+
+		// Clean up from previous iteration
+		prepare(rooms, options);
+		this->goals.assign(goals, goals + goal_count);
+		open_closed.clear();
+		heap.clear();
+		result.path.clear();
+		result.ops = 0;
+		result.cost = 0;
+		result.incomplete = false;
 
 		// Other initialization
-		look_table[0] = plain_cost;
-		look_table[2] = swamp_cost;
-		this->max_rooms = max_rooms;
-		this->heuristic_weight = heuristic_weight;
+		this->heuristic_weight = options.heuristic_weight;
+		uint32_t max_ops = options.max_ops;
 		uint32_t ops_remaining = max_ops;
-		this->flee = flee;
-		world_position_t origin(origin_js);
+		this->flee = options.flee;
+		use_threat_field = flee && this->goals.size() >= k_threat_field_goals && threat_field.build(this->goals);
 		cost_t min_node_h_cost = std::numeric_limits<cost_t>::max();
 		cost_t min_node_g_cost = std::numeric_limits<cost_t>::max();
 		pos_index_t min_node = 0;
@@ -506,16 +739,25 @@ constexpr bool is_near_border_pos(T val) {
 		// Special case for searching to same node, otherwise it searches everywhere because origin node
 		// is closed
 		if (heuristic(origin) == 0) {
-			return Nan::Undefined();
+			result.status = search_result_t::AT_GOAL;
+			return;
 		}
 
-		_is_in_use = true;
 		try {
+			if (rooms.wants_prefetch()) {
+				std::vector<map_position_t> prefetch_rooms;
+				plan_prefetch(origin, prefetch_rooms);
+				if (!prefetch_rooms.empty()) {
+					rooms.prefetch(prefetch_rooms);
+				}
+			}
+
 			// Prime data for `index_from_pos`
 			if (room_index_from_pos(origin.map_position()) == 0) {
 				// Initial room is inaccessible
-				_is_in_use = false;
-				return Nan::New(-1);
+				trim();
+				result.status = search_result_t::INACCESSIBLE;
+				return;
 			}
 
 			// Initial A* iteration
@@ -546,68 +788,101 @@ constexpr bool is_near_border_pos(T val) {
 					min_node_h_cost = h_cost;
 					min_node_g_cost = g_cost;
 				}
-				if (g_cost + h_cost > max_cost) {
+				if (g_cost + h_cost > options.max_cost) {
 					break;
 				}
 
 				// Add next neighbors to heap
-				jps(current.first, pos, g_cost);
-				--ops_remaining;
+				if (expand(current.first, pos, g_cost)) {
+					--ops_remaining;
+				}
 
 				// Check termination
-				if (v8::Isolate::GetCurrent()->IsExecutionTerminating()) {
-					_is_in_use = false;
-					return Nan::Undefined();
+				if (rooms.is_terminating()) {
+					trim();
+					result.status = search_result_t::ABORTED;
+					return;
 				}
 			}
-		} catch (js_error) {
+		} catch (const js_error&) {
 			// Whoever threw the `js_error` should set the exception for v8
-			_is_in_use = false;
-			return Nan::Undefined();
+			trim();
+			result.status = search_result_t::ABORTED;
+			return;
+		} catch (...) {
+			trim();
+			throw;
 		}
 
 		// Reconstruct path from A* graph
-		v8::Local<v8::Array> path = Nan::New<v8::Array>(0);
 		pos_index_t index = min_node;
 		world_position_t pos = pos_from_index(index);
-		uint32_t ii = 0;
 		while (pos != origin) {
-			v8::Local<v8::Array> tmp = Nan::New<v8::Array>(2);
-			Nan::Set(tmp, 0, Nan::New(pos.xx));
-			Nan::Set(tmp, 1, Nan::New(pos.yy));
-			Nan::Set(path, ii, tmp);
-			++ii;
+			result.path.push_back(pos);
 			index = parents[index];
 			world_position_t next = pos_from_index(index);
 			if (next.range_to(pos) > 1) {
 				world_position_t::direction_t dir = pos.direction_to(next);
 				do {
 					pos = pos.position_in_direction(dir);
-					v8::Local<v8::Array> tmp = Nan::New<v8::Array>(2);
-					Nan::Set(tmp, 0, Nan::New(pos.xx));
-					Nan::Set(tmp, 1, Nan::New(pos.yy));
-					Nan::Set(path, ii, tmp);
-					++ii;
+					result.path.push_back(pos);
 				} while (pos.range_to(next) > 1);
 			}
 			pos = next;
 		}
-		v8::Local<v8::Object> ret = Nan::New<v8::Object>();
-		Nan::Set(ret, Nan::New("path").ToLocalChecked(), path);
-		Nan::Set(ret, Nan::New("ops").ToLocalChecked(), Nan::New(max_ops - ops_remaining));
-		Nan::Set(ret, Nan::New("cost").ToLocalChecked(), Nan::New(min_node_g_cost));
-		Nan::Set(ret, Nan::New("incomplete").ToLocalChecked(), Nan::New<v8::Boolean>(min_node_h_cost != 0));
-		_is_in_use = false;
-		return ret;
+		result.status = search_result_t::OK;
+		result.ops = max_ops - ops_remaining;
+		result.cost = min_node_g_cost;
+		result.incomplete = min_node_h_cost != 0;
+		trim();
 	}
 
-	// Loads static terrain data into module upfront
-	void path_finder_t::load_terrain(v8::Local<v8::Array> terrain) {
-		uint8_t* data = new uint8_t[terrain->Length() * 625];
-		for (uint32_t ii = 0; ii < terrain->Length(); ++ii) {
-			v8::Local<v8::Object> terrain_info = Nan::To<v8::Object>(Nan::Get(terrain, ii).ToLocalChecked()).ToLocalChecked();
-			map_position_t pos = Nan::Get(terrain_info, Nan::New("room").ToLocalChecked()).ToLocalChecked();
-			memcpy(data + ii * 625, *Nan::TypedArrayContents<uint8_t>(Nan::Get(terrain_info, Nan::New("bits").ToLocalChecked()).ToLocalChecked()), 625);
-			path_finder_t::terrain[pos.id] = data + ii * 625;
+	void screeps::serialize_path(world_position_t origin, const search_result_t& result, std::vector<path_segment_t>& segments) {
+		auto start_segment = [&](world_position_t pos) {
+			unsigned int xx = pos.xx % 50, yy = pos.yy % 50;
+			segments.push_back(path_segment_t{pos.map_position(), std::string()});
+			std::string& path = segments.back().path;
+			path.reserve(4 + result.path.size());
+			path.push_back('0' + xx / 10);
+			path.push_back('0' + xx % 10);
+			path.push_back('0' + yy / 10);
+			path.push_back('0' + yy % 10);
+		};
+		segments.clear();
+		world_position_t pos = origin;
+		for (auto ii = result.path.rbegin(); ii != result.path.rend(); ++ii) {
+			if (segments.empty() || !(segments.back().room == ii->map_position())) {
+				start_segment(*ii);
+			}
+			segments.back().path.push_back('1' + pos.direction_to(*ii));
+			pos = *ii;
+		}
+	}
+
+	// Loads static terrain data into module, either upfront or as rooms change. Searches pin the rooms
+	// they use so replaced blocks stay valid until the last one finishes.
+	void path_finder_t::load_terrain(const std::vector<terrain_info_t>& rooms) {
+		std::shared_ptr<uint8_t> data(new uint8_t[rooms.size() * 625], std::default_delete<uint8_t[]>());
+		for (size_t ii = 0; ii < rooms.size(); ++ii) {
+			if (rooms[ii].bits != nullptr) {
+				memcpy(data.get() + ii * 625, rooms[ii].bits, 625);
+			}
+		}
+		// Replaced blocks are released after the lock is dropped
+		std::vector<terrain_ref_t> replaced;
+		replaced.reserve(rooms.size());
+		std::lock_guard<std::mutex> lock(terrain_mutex);
+		for (size_t ii = 0; ii < rooms.size(); ++ii) {
+			auto jj = terrain.find(rooms[ii].pos);
+			if (jj != terrain.end()) {
+				replaced.push_back(std::move(jj->second));
+				if (rooms[ii].bits == nullptr) {
+					terrain.erase(jj);
+					continue;
+				}
+			} else if (rooms[ii].bits == nullptr) {
+				continue;
+			}
+			terrain[rooms[ii].pos] = terrain_ref_t(data, data.get() + ii * 625);
 		}
 	}
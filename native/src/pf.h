@@ -1,41 +1,47 @@
 // Author: Marcel Laverdet <https://github.com/laverdet>
-#include <nan.h>
+#pragma once
 #include <array>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
-#include <unordered_set>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace screeps {
 	typedef uint32_t cost_t; // maximum: longest chebyshev distance of whole map
-	typedef uint32_t pos_index_t; // maximum: k_max_rooms * 2500
-	typedef uint32_t room_index_t; // maximum: k_max_rooms (32 bits tested faster than uint8_t)
-	constexpr size_t k_max_rooms = 64;
-
-	static_assert(std::numeric_limits<pos_index_t>::max() > 2500 * k_max_rooms, "pos_index_t is too small");
+	typedef uint32_t pos_index_t; // maximum: k_max_rooms_limit * 2500
+	typedef uint32_t room_index_t; // maximum: k_max_rooms_limit (32 bits tested faster than uint8_t)
+	constexpr size_t k_max_rooms = 64; // in-game limit, instances never shrink below this
+	constexpr size_t k_max_rooms_limit = 1024; // hard limit for private server tooling
+	constexpr size_t k_initial_rooms = 16; // rooms allocated up front, grows on demand
+	constexpr unsigned int k_astar_transitions = 400; // CostMatrix cost changes between neighbors (of 4900) before a room uses A*
+	constexpr size_t k_prefetch_explore = 256; // rooms a prefetch looks through for a route to the goals
+	constexpr size_t k_prefetch_rooms = 8; // rooms of that route which are prefetched, searches stray from it further along
+	constexpr size_t k_threat_field_goals = 8; // flee goals before the heuristic is precomputed
+	constexpr size_t k_threat_field_area = 512; // tiles of precomputed heuristic per flee goal, past this it costs more than it saves
+
+	static_assert(std::numeric_limits<pos_index_t>::max() > 2500 * k_max_rooms_limit, "pos_index_t is too small");
 
 	//
 	// Stores coordinates of a room on the global world map.
-	// For instance, "E1N1" -> { xx: 129, yy: 126 } -- this is implemented in JS
+	// For instance, "E1N1" -> { xx: 32769, yy: 32766 } -- this is implemented in JS
 	struct map_position_t {
 
 		union {
-			uint16_t id;
+			uint32_t id;
 			struct {
-				uint8_t xx, yy; // maximum: world_size
+				uint16_t xx, yy; // maximum: world_size
 			};
 		};
 
 		map_position_t() {}
 
-		map_position_t(uint8_t xx, uint8_t yy) : xx(xx), yy(yy) {}
-
-		map_position_t(v8::Local<v8::Value> pos) {
-			v8::Local<v8::Object> obj = Nan::To<v8::Object>(pos).ToLocalChecked();
-			xx = Nan::To<uint32_t>(Nan::Get(obj, Nan::New("xx").ToLocalChecked()).ToLocalChecked()).FromJust();
-			yy = Nan::To<uint32_t>(Nan::Get(obj, Nan::New("yy").ToLocalChecked()).ToLocalChecked()).FromJust();
-		}
+		map_position_t(uint16_t xx, uint16_t yy) : xx(xx), yy(yy) {}
 
 		bool operator== (map_position_t right) const {
 			return this->id == right.id;
@@ -47,7 +53,7 @@ namespace screeps {
 
 		struct hash_t {
 			size_t operator()(const map_position_t& val) const {
-				return std::hash<uint16_t>()(val.id);
+				return std::hash<uint32_t>()(val.id);
 			}
 		};
 	};
@@ -62,7 +68,7 @@ namespace screeps {
 			union {
 				uint64_t id;
 				struct {
-					uint32_t xx, yy; // maximum: world_size[255] * 50 (32 bits tested faster than uint16_t)
+					uint32_t xx, yy; // maximum: world_size[65535] * 50
 				};
 			};
 
@@ -74,12 +80,6 @@ namespace screeps {
 
 			explicit world_position_t(uint64_t id) : id(id) {}
 
-			world_position_t(v8::Local<v8::Value> pos) {
-				v8::Local<v8::Object> obj = Nan::To<v8::Object>(pos).ToLocalChecked();
-				xx = Nan::To<uint32_t>(Nan::Get(obj, Nan::New("xx").ToLocalChecked()).ToLocalChecked()).FromJust();
-				yy = Nan::To<uint32_t>(Nan::Get(obj, Nan::New("yy").ToLocalChecked()).ToLocalChecked()).FromJust();
-			}
-
 			static world_position_t null() {
 				return world_position_t(0);
 			}
@@ -87,17 +87,21 @@ namespace screeps {
 			friend std::ostream& operator<< (std::ostream& os, const world_position_t& that) {
 				int xx = that.xx / 50;
 				int yy = that.yy / 50;
-				bool w = xx <= 127;
-				bool n = yy <= 127;
+				bool w = xx <= 32767;
+				bool n = yy <= 32767;
 				os <<"world_position_t(["
 					<<(w ? 'W' : 'E')
-					<<(w ? 127 - xx : xx - 128)
+					<<(w ? 32767 - xx : xx - 32768)
 					<<(n ? 'N' : 'S')
-					<<(n ? 127 - yy : yy - 128)
+					<<(n ? 32767 - yy : yy - 32768)
 					<<"] " <<that.xx % 50 <<", " <<that.yy % 50 <<")";
 				return os;
 			}
 
+			bool operator== (world_position_t right) const {
+				return id == right.id;
+			}
+
 			bool operator!= (world_position_t right) const {
 				return id != right.id;
 			}
@@ -171,16 +175,21 @@ namespace screeps {
 
 	//
 	// Simple open-closed list
-	template <size_t capacity>
 	class open_closed_t {
 
 		private:
 			using marker_t = uint32_t;
-			std::array<marker_t, capacity> list;
+			std::vector<marker_t> list;
 			marker_t marker;
 
 		public:
-			open_closed_t() : list{}, marker(1) {}
+			open_closed_t() : marker(1) {}
+
+			// New entries are neither open nor closed, existing entries are kept
+			void resize(size_t capacity) {
+				list.resize(capacity, 0);
+				list.shrink_to_fit();
+			}
 
 			void clear() {
 				if (std::numeric_limits<marker_t>::max() - 2 <= marker) {
@@ -208,23 +217,108 @@ namespace screeps {
 			}
 	};
 
+	//
+	// Small open-addressing hash from map position to room index, cleared for each search. Blocked
+	// rooms are stored as `blocked`. This replaces a reverse table indexed by every possible room,
+	// which stopped being practical once room coordinates grew past 8 bits.
+	class room_index_table_t {
+		public:
+			static constexpr room_index_t blocked = std::numeric_limits<room_index_t>::max();
+
+		private:
+			struct entry_t {
+				map_position_t pos;
+				room_index_t index; // 0 = empty slot
+			};
+			std::vector<entry_t> table;
+			size_t size_ = 0;
+			unsigned int shift;
+			// Almost every lookup is for the same room as the last one
+			map_position_t last_pos;
+			room_index_t last_index = 0;
+
+			size_t slot(map_position_t pos) const {
+				return uint32_t(pos.id * 2654435769u) >> shift;
+			}
+
+			void rehash(size_t capacity) {
+				std::vector<entry_t> old(capacity, entry_t{map_position_t(0, 0), 0});
+				old.swap(table);
+				shift = 32;
+				for (size_t ii = capacity; ii > 1; ii >>= 1) {
+					--shift;
+				}
+				size_ = 0;
+				for (auto& ii : old) {
+					if (ii.index != 0) {
+						insert(ii.pos, ii.index);
+					}
+				}
+			}
+
+		public:
+			room_index_table_t() {
+				rehash(64);
+			}
+
+			// Returns 0 if the room hasn't been seen in this search
+			room_index_t find(map_position_t pos) {
+				if (pos == last_pos && last_index != 0) {
+					return last_index;
+				}
+				for (size_t ii = slot(pos); ; ii = (ii + 1) & (table.size() - 1)) {
+					if (table[ii].index == 0) {
+						return 0;
+					} else if (table[ii].pos == pos) {
+						last_pos = pos;
+						return last_index = table[ii].index;
+					}
+				}
+			}
+
+			void insert(map_position_t pos, room_index_t index) {
+				if ((size_ + 1) * 2 > table.size()) {
+					rehash(table.size() * 2);
+				}
+				size_t ii = slot(pos);
+				while (table[ii].index != 0) {
+					ii = (ii + 1) & (table.size() - 1);
+				}
+				table[ii] = entry_t{pos, index};
+				++size_;
+			}
+
+			void clear() {
+				if (size_ != 0) {
+					std::fill(table.begin(), table.end(), entry_t{map_position_t(0, 0), 0});
+					size_ = 0;
+				}
+				last_index = 0;
+			}
+	};
+
 	//
 	// Stores context about a room, specific to each search
 	struct room_info_t {
-		uint8_t* terrain;
+		const uint8_t* terrain;
 		uint8_t (*cost_matrix)[50];
 		map_position_t pos;
+		bool astar; // jumps stop on almost every tile, expand nodes in this room with plain A*
 		static uint8_t cost_matrix0[2500];
 
 		room_info_t() = default;
 
-		room_info_t(uint8_t* terrain, uint8_t* cost_matrix, map_position_t pos) :
+		room_info_t(const uint8_t* terrain, uint8_t* cost_matrix, map_position_t pos) :
 			terrain(terrain),
 			cost_matrix((uint8_t(*)[50])(cost_matrix == NULL ? cost_matrix0 : cost_matrix)),
-			pos(pos)
+			pos(pos),
+			astar(cost_matrix != NULL && count_transitions(cost_matrix) >= k_astar_transitions)
 			{
 		}
 
+		// Number of horizontally or vertically adjacent tiles with different CostMatrix values
+		static unsigned int count_transitions(const uint8_t* cost_matrix);
+
 		uint8_t look(uint8_t xx, uint8_t yy) const {
 			if (cost_matrix[xx][yy]) {
 				return cost_matrix[xx][yy];
@@ -239,29 +333,184 @@ namespace screeps {
 	struct goal_t {
 		cost_t range;
 		world_position_t pos;
-		goal_t(v8::Local<v8::Value> goal) {
-			v8::Local<v8::Object> obj = Nan::To<v8::Object>(goal).ToLocalChecked();
-			range = Nan::To<uint32_t>(Nan::Get(obj, Nan::New("range").ToLocalChecked()).ToLocalChecked()).FromJust();
-			pos = world_position_t(Nan::Get(obj, Nan::New("pos").ToLocalChecked()).ToLocalChecked());
-		}
+		goal_t() = default;
+		goal_t(world_position_t pos, cost_t range) : range(range), pos(pos) {}
+	};
+
+	//
+	// Thrown by a room provider to abort a search. Whoever throws it is responsible for reporting
+	// the error to the caller
+	class js_error: public std::runtime_error {
+		public: js_error() : std::runtime_error("js error") {}
+	};
+
+	//
+	// Supplies CostMatrix data for each room as the search enters it. The search never touches v8
+	// directly, everything goes through one of these.
+	class room_provider_t {
+		public:
+			virtual ~room_provider_t() = default;
+
+			// Returns false if the room is blocked, otherwise sets `cost_matrix` (nullptr for terrain
+			// only). The data must stay valid until the search is finished.
+			virtual bool load(map_position_t pos, uint8_t*& cost_matrix) = 0;
+
+			// Checked once per iteration, returning true aborts the search
+			virtual bool is_terminating() {
+				return false;
+			}
+
+			// Providers which are slow to call once per room can return true here, and the search passes
+			// the rooms it expects to enter to `prefetch` before it starts. `load` is still called for
+			// every room the search actually enters.
+			virtual bool wants_prefetch() {
+				return false;
+			}
+
+			virtual void prefetch(const std::vector<map_position_t>& rooms) {}
+	};
+
+	//
+	// Room provider for CostMatrix data which is known before the search starts, so the search never
+	// has to call back into JS. Rooms which aren't listed use terrain only, unless the provider is
+	// restricted (for instance to a route from `Game.map.findRoute`) in which case they are blocked.
+	class static_room_provider_t : public room_provider_t {
+		private:
+			struct entry_t {
+				map_position_t pos;
+				uint8_t* cost_matrix;
+				bool blocked;
+			};
+			std::vector<entry_t> rooms;
+			bool restricted = false;
+
+		public:
+			void clear() {
+				rooms.clear();
+				restricted = false;
+			}
+
+			void set_restricted(bool restricted) {
+				this->restricted = restricted;
+			}
+
+			void add(map_position_t pos, uint8_t* cost_matrix) {
+				rooms.push_back(entry_t{pos, cost_matrix, false});
+			}
+
+			void block(map_position_t pos) {
+				rooms.push_back(entry_t{pos, nullptr, true});
+			}
+
+			bool load(map_position_t pos, uint8_t*& cost_matrix) override {
+				for (auto& ii : rooms) {
+					if (ii.pos == pos) {
+						cost_matrix = ii.cost_matrix;
+						return !ii.blocked;
+					}
+				}
+				cost_matrix = nullptr;
+				return !restricted;
+			}
+	};
+
+	//
+	// Plain options for a search, see `lib/path-finder.js` for defaults
+	struct search_options_t {
+		cost_t plain_cost = 1;
+		cost_t swamp_cost = 5;
+		room_index_t max_rooms = 16;
+		uint32_t max_ops = 2000;
+		uint32_t max_cost = std::numeric_limits<uint32_t>::max();
+		bool flee = false;
+		double heuristic_weight = 1.2;
+		// MOVE parts per body part that generates fatigue. When set, cost is the number of ticks a creep
+		// with that body takes to make each move, and CostMatrix values are fatigue factors (1 for roads,
+		// 2 for plains, 10 for swamps) instead of costs. `plain_cost` and `swamp_cost` are ignored.
+		double move_ratio = 0;
+	};
+
+	//
+	// Output of a search. `path` is in reverse order and does not include the origin
+	struct search_result_t {
+		enum status_t { OK, AT_GOAL, INACCESSIBLE, ABORTED };
+		status_t status;
+		std::vector<world_position_t> path;
+		uint32_t ops;
+		cost_t cost;
+		bool incomplete;
+	};
+
+	//
+	// Compact form of one room's part of a path, the same as `Room.serializePath`: the first step in the
+	// room as "xxyy" followed by the direction into each step, starting with that first one. Directions
+	// are 1 through 8 for TOP through TOP_LEFT just like the game's constants.
+	struct path_segment_t {
+		map_position_t room;
+		std::string path;
+	};
+
+	// Splits a search result into per-room segments, the first step of the first one is taken from `origin`
+	void serialize_path(world_position_t origin, const search_result_t& result, std::vector<path_segment_t>& segments);
+
+	//
+	// Static terrain data for one room, as sent from JS. `bits` is nullptr to remove the room
+	struct terrain_info_t {
+		map_position_t pos;
+		const uint8_t* bits;
+	};
+
+	//
+	// Packed terrain bits for one room. Rooms loaded together share an allocation which is freed when
+	// the last of them is replaced and no search holds a reference
+	using terrain_ref_t = std::shared_ptr<const uint8_t>;
+
+	//
+	// Flee heuristic precomputed for many goals. Holds the largest `range - distance` to any goal for
+	// every tile within range of one, so the heuristic costs the same no matter how many goals there
+	// are.
+	class threat_field_t {
+		private:
+			std::vector<cost_t> field; // stored [yy][xx] relative to `left` and `top`
+			uint32_t left, top, width = 0, height = 0;
+
+		public:
+			// Returns false without building anything if the field would be too big to pay off
+			bool build(const std::vector<goal_t>& goals);
+
+			cost_t at(world_position_t pos) const {
+				uint32_t xx = pos.xx - left, yy = pos.yy - top;
+				if (xx >= width || yy >= height) {
+					return 0;
+				}
+				return field[yy * width + xx];
+			}
 	};
 
 	//
 	// Priority queue implementation w/ support for updating priorities
-	template <class index_t, class priority_t, size_t capacity>
+	template <class index_t, class priority_t>
 	class heap_t {
 
 		private:
-			std::array<priority_t, capacity> priorities;
+			std::vector<priority_t> priorities;
 			// Theoretical max number of open nodes is total node divided by 8. 1 node opens all its
 			// neighbors repeated perfectly over the whole graph. It's impossible to actually hit this
 			// limit with a regular pathfinder operation
-			std::array<index_t, 2500 * k_max_rooms / 8> heap;
+			std::vector<index_t> heap;
 			size_t size_;
 
 		public:
 			heap_t() : size_(0) {}
 
+			// Resizes for `capacity` nodes, open nodes are kept
+			void resize(size_t capacity) {
+				priorities.resize(capacity);
+				priorities.shrink_to_fit();
+				heap.resize(capacity / 8);
+				heap.shrink_to_fit();
+			}
+
 			bool empty() const {
 				return size_ == 0;
 			}
@@ -335,33 +584,40 @@ namespace screeps {
 	};
 
 	//
-	// Path finder encapsulation. Multiple instances are thread-safe
+	// Path finder encapsulation. Multiple instances are thread-safe, but each instance runs one search
+	// at a time, see `path_finder_pool_t`
 	class path_finder_t {
+		friend class coop_planner_t;
+
 		private:
-			static constexpr size_t map_position_size = 1 << sizeof(map_position_t) * 8;
 			static constexpr cost_t obstacle = std::numeric_limits<cost_t>::max();
-			std::array<room_info_t, k_max_rooms> room_table;
+			std::vector<room_info_t> room_table;
 			size_t room_table_size = 0;
-			std::array<room_index_t, map_position_size> reverse_room_table;
-			std::unordered_set<map_position_t, map_position_t::hash_t> blocked_rooms;
-			std::array<pos_index_t, 2500 * k_max_rooms> parents;
-			open_closed_t<2500 * k_max_rooms> open_closed;
-			heap_t<pos_index_t, cost_t, 2500 * k_max_rooms> heap;
+			size_t room_capacity = 0;
+			room_index_table_t room_indices;
+			std::vector<pos_index_t> parents;
+			open_closed_t open_closed;
+			heap_t<pos_index_t, cost_t> heap;
 			std::vector<goal_t> goals;
 			cost_t look_table[4] = {obstacle, obstacle, obstacle, obstacle};
+			cost_t cost_table[256]; // CostMatrix value -> cost
+			cost_t heuristic_scale; // cheapest possible move
 			double heuristic_weight;
 			room_index_t max_rooms;
 			bool flee;
-			v8::Local<v8::Value>* room_data_handles;
-			v8::Local<v8::Function>* room_callback;
-			bool _is_in_use = false;
-
-			static std::array<uint8_t*, map_position_size> terrain;
-
-			class js_error: public std::runtime_error {
-				public: js_error() : std::runtime_error("js error") {}
-			};
-
+			room_provider_t* rooms;
+			threat_field_t threat_field;
+			bool use_threat_field = false;
+			std::vector<terrain_ref_t> pinned_terrain;
+
+			static std::unordered_map<map_position_t, terrain_ref_t, map_position_t::hash_t> terrain;
+			static std::mutex terrain_mutex;
+
+			void resize(size_t rooms);
+			void trim();
+			void set_costs(const search_options_t& options);
+			void prepare(room_provider_t& rooms, const search_options_t& options);
+			void plan_prefetch(world_position_t origin, std::vector<map_position_t>& out) const;
 			room_index_t room_index_from_pos(const map_position_t map_pos);
 			pos_index_t index_from_pos(const world_position_t pos);
 			world_position_t pos_from_index(pos_index_t index) const;
@@ -377,22 +633,49 @@ namespace screeps {
 			world_position_t jump_xy(cost_t cost, world_position_t pos, int dx, int dy);
 			world_position_t jump(cost_t cost, world_position_t pos, int dx, int dy);
 			void jps(pos_index_t index, world_position_t pos, cost_t g_cost);
+			bool expand(pos_index_t index, world_position_t pos, cost_t g_cost);
+			bool is_jump_point(pos_index_t index, world_position_t pos) const;
 			void jump_neighbor(world_position_t pos, pos_index_t index, world_position_t neighbor, cost_t g_cost, cost_t cost, cost_t n_cost);
 
 		public:
-			v8::Local<v8::Value> search(
-				v8::Local<v8::Value> origin_js, v8::Local<v8::Array> goals_js,
-				v8::Local<v8::Function> room_callback,
-				cost_t plain_cost, cost_t swamp_cost,
-				uint8_t max_rooms, uint32_t max_ops, uint32_t max_cost,
-				bool flee,
-				double heuristic_weight
-			);
+			path_finder_t() {
+				resize(k_initial_rooms);
+			}
 
-			bool is_in_use() const {
-				return _is_in_use;
+			// Scratch space for callers to build the goals of a search in. Kept with the path finder so
+			// the storage is reused by whoever leases it from the pool next.
+			std::vector<goal_t> goal_storage;
+
+			// Exit tiles only lead straight across into the next room, or back into their own room
+			static bool is_possible_move(world_position_t pos, world_position_t neighbor) {
+				if (pos.xx % 50 == 0) {
+					return neighbor.xx % 50 == 49 ? pos.yy == neighbor.yy : pos.xx != neighbor.xx;
+				} else if (pos.xx % 50 == 49) {
+					return neighbor.xx % 50 == 0 ? pos.yy == neighbor.yy : pos.xx != neighbor.xx;
+				} else if (pos.yy % 50 == 0) {
+					return neighbor.yy % 50 == 49 ? pos.xx == neighbor.xx : pos.yy != neighbor.yy;
+				} else if (pos.yy % 50 == 49) {
+					return neighbor.yy % 50 == 0 ? pos.xx == neighbor.xx : pos.yy != neighbor.yy;
+				}
+				return true;
 			}
 
-			static void load_terrain(v8::Local<v8::Array> terrain);
+			void search(
+				world_position_t origin, const goal_t* goals, size_t goal_count,
+				room_provider_t& rooms,
+				const search_options_t& options,
+				search_result_t& result
+			);
+
+			// Adds, replaces or removes rooms. Safe to call while other threads are searching, they keep
+			// the terrain they started with
+			static void load_terrain(const std::vector<terrain_info_t>& rooms);
+
+			// Packed terrain bits for a room, or nullptr if it wasn't loaded
+			static terrain_ref_t terrain_data(map_position_t pos) {
+				std::lock_guard<std::mutex> lock(terrain_mutex);
+				auto ii = terrain.find(pos);
+				return ii == terrain.end() ? nullptr : ii->second;
+			}
 	};
 };
@@ -0,0 +1,42 @@
+#include "pool.h"
+#include <algorithm>
+
+using namespace screeps;
+
+	path_finder_pool_t& path_finder_pool_t::local() {
+		thread_local path_finder_pool_t pool;
+		return pool;
+	}
+
+	path_finder_pool_t::lease_t path_finder_pool_t::take() {
+		std::unique_ptr<path_finder_t> pf;
+		if (idle.empty()) {
+			pf = std::make_unique<path_finder_t>();
+			++counters.allocations;
+			++counters.size;
+		} else {
+			pf = std::move(idle.back());
+			idle.pop_back();
+		}
+		++counters.in_use;
+		counters.peak_in_use = std::max(counters.peak_in_use, counters.in_use);
+		window_peak = std::max(window_peak, counters.in_use);
+		return lease_t(std::move(pf));
+	}
+
+	// Every `k_pool_trim_period` releases, frees the idle path finders beyond the most that were in
+	// use at once during that period. Recursion which happens regularly keeps its path finders, a
+	// one-off deep recursion gives them back eventually.
+	void path_finder_pool_t::release(std::unique_ptr<path_finder_t> pf) {
+		idle.push_back(std::move(pf));
+		--counters.in_use;
+		if (++releases % k_pool_trim_period == 0) {
+			size_t keep = std::max(k_pool_keep, window_peak);
+			while (counters.size > keep && !idle.empty()) {
+				idle.pop_back();
+				--counters.size;
+				++counters.trimmed;
+			}
+			window_peak = counters.in_use;
+		}
+	}
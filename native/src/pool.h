@@ -0,0 +1,70 @@
+#pragma once
+#include "pf.h"
+#include <memory>
+#include <vector>
+
+namespace screeps {
+
+	constexpr size_t k_pool_keep = 2; // idle path finders each thread always holds on to
+	constexpr size_t k_pool_trim_period = 256; // releases between trims of unused path finders
+
+	//
+	// Per-thread free list of path finders. A search started from inside a room callback needs its
+	// own path finder, which costs ~500kb of storage to set up (~2mb once it grows to `k_max_rooms`).
+	// Path finders are handed back to the pool when the search is done, and the pool only frees the
+	// ones which weren't needed since the last trim.
+	class path_finder_pool_t {
+		public:
+			struct stats_t {
+				size_t size; // path finders owned by this thread's pool
+				size_t in_use;
+				size_t peak_in_use;
+				size_t allocations; // path finders ever created
+				size_t trimmed; // path finders freed for being unused
+			};
+
+			//
+			// Exclusive use of one path finder, which goes back to the pool on destruction
+			class lease_t {
+				private:
+					std::unique_ptr<path_finder_t> pf;
+
+				public:
+					explicit lease_t(std::unique_ptr<path_finder_t> pf) : pf(std::move(pf)) {}
+					lease_t(lease_t&&) = default;
+					lease_t& operator=(lease_t&&) = delete;
+					~lease_t() {
+						if (pf != nullptr) {
+							local().release(std::move(pf));
+						}
+					}
+
+					path_finder_t& operator*() const {
+						return *pf;
+					}
+
+					path_finder_t* operator->() const {
+						return pf.get();
+					}
+			};
+
+			static lease_t acquire() {
+				return local().take();
+			}
+
+			// Stats for the calling thread's pool
+			static stats_t stats() {
+				return local().counters;
+			}
+
+		private:
+			std::vector<std::unique_ptr<path_finder_t>> idle;
+			stats_t counters = { 0, 0, 0, 0, 0 };
+			size_t window_peak = 0; // most path finders in use at once since the last trim
+			size_t releases = 0;
+
+			static path_finder_pool_t& local();
+			lease_t take();
+			void release(std::unique_ptr<path_finder_t> pf);
+	};
+};
@@ -0,0 +1,69 @@
+// Runs searches recorded by `trace_t` again outside of node, for timing and profiling:
+//   replay <trace file> [repeat]
+// Prints one line per search with its timing, and flags any search which doesn't return what it
+// returned when it was recorded.
+#include "pf.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace screeps;
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s <trace file> [repeat]\n", argv[0]);
+		return 1;
+	}
+	int repeat = argc > 2 ? std::max(1, std::atoi(argv[2])) : 1;
+	std::FILE* file = std::fopen(argv[1], "rb");
+	if (file == nullptr || !trace_t::read_header(file)) {
+		std::fprintf(stderr, "%s: not a trace log\n", argv[1]);
+		return 1;
+	}
+
+	path_finder_t pf;
+	trace_record_t record;
+	search_result_t result;
+	size_t count = 0, mismatches = 0;
+	uint64_t total_ops = 0;
+	double total_time = 0;
+	std::printf("search\trooms\tstatus\tops\tcost\tpath\tusec\n");
+	while (trace_t::read(file, record)) {
+		std::vector<terrain_info_t> terrain;
+		static_room_provider_t rooms;
+		for (auto& room : record.rooms) {
+			terrain.push_back(terrain_info_t{room.pos, room.terrain});
+			if (room.blocked) {
+				rooms.block(room.pos);
+			} else {
+				rooms.add(room.pos, room.has_cost_matrix ? room.cost_matrix : nullptr);
+			}
+		}
+		path_finder_t::load_terrain(terrain);
+		rooms.set_restricted(true);
+
+		auto start = std::chrono::steady_clock::now();
+		for (int ii = 0; ii < repeat; ++ii) {
+			pf.search(record.origin, record.goals.data(), record.goals.size(), rooms, record.options, result);
+		}
+		double usec = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / repeat;
+
+		bool mismatch =
+			result.status != record.status || result.ops != record.ops ||
+			result.cost != record.cost || result.path.size() != record.path_length;
+		std::printf(
+			"%zu\t%zu\t%d\t%u\t%u\t%zu\t%.1f%s\n",
+			count, record.rooms.size(), result.status, result.ops, result.cost, result.path.size(), usec,
+			mismatch ? "\tMISMATCH" : ""
+		);
+		++count;
+		mismatches += mismatch;
+		total_ops += result.ops;
+		total_time += usec;
+	}
+	std::fclose(file);
+	std::printf("%zu searches, %llu ops, %.1f usec, %zu mismatches\n", count, (unsigned long long)total_ops, total_time, mismatches);
+	return mismatches == 0 ? 0 : 2;
+}
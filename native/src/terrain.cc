@@ -0,0 +1,115 @@
+#include "terrain.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace screeps;
+
+	void terrain_t::get_rect(const uint8_t* bits, uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2, uint8_t* out) {
+		for (unsigned int xx = x1; xx <= x2; ++xx) {
+			for (unsigned int yy = y1; yy <= y2; ++yy) {
+				*out++ = at(bits, xx, yy);
+			}
+		}
+	}
+
+	void terrain_t::count_rect(const uint8_t* bits, uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2, uint32_t counts[3]) {
+		counts[PLAIN] = counts[WALL] = counts[SWAMP] = 0;
+		for (unsigned int xx = x1; xx <= x2; ++xx) {
+			for (unsigned int yy = y1; yy <= y2; ++yy) {
+				uint8_t value = at(bits, xx, yy);
+				mask_t mask = value & WALL ? WALL : mask_t(value);
+				++counts[mask];
+			}
+		}
+	}
+
+	// Two raster passes, each tile takes the minimum of its already visited neighbors + 1
+	void terrain_t::distance_transform_chessboard(const uint8_t* bits, uint8_t* out) {
+		auto get = [out](int xx, int yy) -> int {
+			return xx < 0 || xx >= 50 || yy < 0 || yy >= 50 ? 0 : out[xx * 50 + yy];
+		};
+		for (int xx = 0; xx < 50; ++xx) {
+			for (int yy = 0; yy < 50; ++yy) {
+				if (at(bits, xx, yy) & WALL) {
+					out[xx * 50 + yy] = 0;
+				} else {
+					out[xx * 50 + yy] = 1 + std::min({ get(xx - 1, yy - 1), get(xx - 1, yy), get(xx - 1, yy + 1), get(xx, yy - 1) });
+				}
+			}
+		}
+		for (int xx = 49; xx >= 0; --xx) {
+			for (int yy = 49; yy >= 0; --yy) {
+				int value = out[xx * 50 + yy];
+				if (value != 0) {
+					out[xx * 50 + yy] = std::min({ value, 1 + get(xx + 1, yy + 1), 1 + get(xx + 1, yy), 1 + get(xx + 1, yy - 1), 1 + get(xx, yy + 1) });
+				}
+			}
+		}
+	}
+
+	// Felzenszwalb & Huttenlocher: exact squared distances from a 1D lower envelope of parabolas, run
+	// down each column and then along each row. The room is padded by one tile of wall on each side, so
+	// the first entry of every line is a wall and the envelope is never empty.
+	void terrain_t::distance_transform_euclidean(const uint8_t* bits, uint8_t* out) {
+		constexpr int size = 52;
+		constexpr int infinity = size * size * 2;
+		int grid[size][size];
+		for (int xx = 0; xx < size; ++xx) {
+			for (int yy = 0; yy < size; ++yy) {
+				bool wall = xx == 0 || yy == 0 || xx == size - 1 || yy == size - 1 || (at(bits, xx - 1, yy - 1) & WALL);
+				grid[xx][yy] = wall ? 0 : infinity;
+			}
+		}
+
+		int envelope[size];
+		double boundaries[size + 1];
+		int values[size];
+		auto transform = [&](auto get, auto set) {
+			int kk = 0;
+			envelope[0] = 0;
+			boundaries[0] = -INFINITY;
+			boundaries[1] = INFINITY;
+			for (int qq = 0; qq < size; ++qq) {
+				values[qq] = get(qq);
+			}
+			for (int qq = 1; qq < size; ++qq) {
+				if (values[qq] == infinity) {
+					continue;
+				}
+				double ss;
+				while (true) {
+					int vv = envelope[kk];
+					ss = ((values[qq] + qq * qq) - (values[vv] + vv * vv)) / (2.0 * (qq - vv));
+					if (ss <= boundaries[kk]) {
+						--kk;
+					} else {
+						break;
+					}
+				}
+				++kk;
+				envelope[kk] = qq;
+				boundaries[kk] = ss;
+				boundaries[kk + 1] = INFINITY;
+			}
+			kk = 0;
+			for (int qq = 0; qq < size; ++qq) {
+				while (boundaries[kk + 1] < qq) {
+					++kk;
+				}
+				int vv = envelope[kk];
+				set(qq, (qq - vv) * (qq - vv) + values[vv]);
+			}
+		};
+		for (int xx = 0; xx < size; ++xx) {
+			transform([&](int yy) { return grid[xx][yy]; }, [&](int yy, int value) { grid[xx][yy] = value; });
+		}
+		for (int yy = 0; yy < size; ++yy) {
+			transform([&](int xx) { return grid[xx][yy]; }, [&](int xx, int value) { grid[xx][yy] = value; });
+		}
+
+		for (int xx = 0; xx < 50; ++xx) {
+			for (int yy = 0; yy < 50; ++yy) {
+				out[xx * 50 + yy] = std::min(255, int(std::sqrt(double(grid[xx + 1][yy + 1]))));
+			}
+		}
+	}
@@ -0,0 +1,29 @@
+#pragma once
+#include "pf.h"
+
+namespace screeps {
+
+	//
+	// Queries over one room of packed terrain as loaded by `path_finder_t::load_terrain`. Output is
+	// one byte per tile stored [xx][yy], the same as CostMatrix data. Rectangles are inclusive.
+	class terrain_t {
+		public:
+			enum mask_t { PLAIN = 0, WALL = 1, SWAMP = 2 };
+
+			static uint8_t at(const uint8_t* bits, unsigned int xx, unsigned int yy) {
+				unsigned int index = xx * 50 + yy;
+				return 0x03 & bits[index / 4] >> (index % 4 * 2);
+			}
+
+			// Copies terrain values in a rectangle, `out` holds (x2 - x1 + 1) * (y2 - y1 + 1) bytes
+			static void get_rect(const uint8_t* bits, uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2, uint8_t* out);
+
+			// Counts plains, walls and swamps in a rectangle, indexed by `mask_t`
+			static void count_rect(const uint8_t* bits, uint8_t x1, uint8_t y1, uint8_t x2, uint8_t y2, uint32_t counts[3]);
+
+			// Distance from each tile to the nearest wall, tiles outside the room count as walls. Walls are
+			// 0. Chessboard is exact, Euclidean is rounded down.
+			static void distance_transform_chessboard(const uint8_t* bits, uint8_t* out);
+			static void distance_transform_euclidean(const uint8_t* bits, uint8_t* out);
+	};
+};
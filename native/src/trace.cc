@@ -0,0 +1,249 @@
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace screeps;
+
+	// Log layout, all values in host byte order:
+	//   header: "SPFT" uint32 version
+	//   record: uint32 length, then `length` bytes of
+	//     origin (uint32 xx, yy), options (uint32 plain_cost, swamp_cost, max_rooms, max_ops, max_cost,
+	//     uint8 flee, double heuristic_weight, double move_ratio), uint32 goal count, goals (uint32 xx, yy, range),
+	//     result (uint8 status, uint32 ops, cost, path length), uint32 room count, rooms (uint16 xx, yy,
+	//     uint8 flags, 625 bytes terrain, 2500 bytes CostMatrix if flags has `has_cost_matrix`)
+	static constexpr char magic[4] = { 'S', 'P', 'F', 'T' };
+	static constexpr uint32_t version = 2;
+	enum room_flags_t : uint8_t { room_blocked = 1, room_has_cost_matrix = 2 };
+
+	std::atomic<bool> trace_t::enabled(false);
+	std::atomic<uint64_t> trace_t::counter(0);
+	std::atomic<uint64_t> trace_t::sample_period(1);
+	std::mutex trace_t::mutex;
+	std::FILE* trace_t::file = nullptr;
+	size_t trace_t::bytes_remaining = 0;
+
+	template <class type_t>
+	static void put(std::vector<uint8_t>& buffer, type_t value) {
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(type_t));
+	}
+
+	static void put_bytes(std::vector<uint8_t>& buffer, const uint8_t* bytes, size_t length) {
+		buffer.insert(buffer.end(), bytes, bytes + length);
+	}
+
+	//
+	// Passes rooms through from the real provider and keeps a copy of everything it hands out
+	class recording_room_provider_t : public room_provider_t {
+		private:
+			room_provider_t& rooms;
+
+		public:
+			std::vector<uint8_t> room_data;
+			uint32_t room_count = 0;
+
+			recording_room_provider_t(room_provider_t& rooms) : rooms(rooms) {}
+
+			bool load(map_position_t pos, uint8_t*& cost_matrix) override {
+				bool ret = rooms.load(pos, cost_matrix);
+				put<uint16_t>(room_data, pos.xx);
+				put<uint16_t>(room_data, pos.yy);
+				put<uint8_t>(room_data, (ret ? 0 : room_blocked) | (ret && cost_matrix != nullptr ? room_has_cost_matrix : 0));
+				terrain_ref_t terrain = path_finder_t::terrain_data(pos);
+				if (terrain == nullptr) {
+					room_data.resize(room_data.size() + 625);
+				} else {
+					put_bytes(room_data, terrain.get(), 625);
+				}
+				if (ret && cost_matrix != nullptr) {
+					put_bytes(room_data, cost_matrix, 2500);
+				}
+				++room_count;
+				return ret;
+			}
+
+			bool is_terminating() override {
+				return rooms.is_terminating();
+			}
+
+			bool wants_prefetch() override {
+				return rooms.wants_prefetch();
+			}
+
+			void prefetch(const std::vector<map_position_t>& rooms) override {
+				this->rooms.prefetch(rooms);
+			}
+	};
+
+	bool trace_t::start(const std::string& path, size_t max_bytes, double sample_rate) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (file != nullptr) {
+			enabled = false;
+			std::fclose(file);
+		}
+		file = std::fopen(path.c_str(), "wb");
+		if (file == nullptr) {
+			return false;
+		}
+		std::fwrite(magic, 1, sizeof(magic), file);
+		std::fwrite(&version, sizeof(version), 1, file);
+		size_t header_size = sizeof(magic) + sizeof(version);
+		bytes_remaining = max_bytes > header_size ? max_bytes - header_size : 0;
+		sample_period = sample_rate > 0 ? uint64_t(std::max(1.0, std::round(1 / sample_rate))) : std::numeric_limits<uint64_t>::max();
+		counter = 0;
+		enabled = true;
+		return true;
+	}
+
+	void trace_t::stop() {
+		std::lock_guard<std::mutex> lock(mutex);
+		enabled = false;
+		if (file != nullptr) {
+			std::fclose(file);
+			file = nullptr;
+		}
+	}
+
+	bool trace_t::sample() {
+		return counter++ % sample_period == 0;
+	}
+
+	// Appends one record, or closes the log if it would go past the limit
+	void trace_t::write(const std::vector<uint8_t>& record) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (file == nullptr) {
+			return;
+		}
+		uint32_t length = record.size();
+		if (sizeof(length) + length > bytes_remaining) {
+			enabled = false;
+			std::fclose(file);
+			file = nullptr;
+			return;
+		}
+		std::fwrite(&length, sizeof(length), 1, file);
+		std::fwrite(record.data(), 1, length, file);
+		std::fflush(file);
+		bytes_remaining -= sizeof(length) + length;
+	}
+
+	void trace_t::search(
+		path_finder_t& pf,
+		world_position_t origin, const goal_t* goals, size_t goal_count,
+		room_provider_t& rooms,
+		const search_options_t& options,
+		search_result_t& result
+	) {
+		if (!enabled.load(std::memory_order_relaxed) || !sample()) {
+			pf.search(origin, goals, goal_count, rooms, options, result);
+			return;
+		}
+		recording_room_provider_t recorder(rooms);
+		pf.search(origin, goals, goal_count, recorder, options, result);
+		if (result.status == search_result_t::ABORTED) {
+			return;
+		}
+
+		std::vector<uint8_t> record;
+		record.reserve(64 + goal_count * 12 + recorder.room_data.size());
+		put<uint32_t>(record, origin.xx);
+		put<uint32_t>(record, origin.yy);
+		put<uint32_t>(record, options.plain_cost);
+		put<uint32_t>(record, options.swamp_cost);
+		put<uint32_t>(record, options.max_rooms);
+		put<uint32_t>(record, options.max_ops);
+		put<uint32_t>(record, options.max_cost);
+		put<uint8_t>(record, options.flee);
+		put<double>(record, options.heuristic_weight);
+		put<double>(record, options.move_ratio);
+		put<uint32_t>(record, goal_count);
+		for (size_t ii = 0; ii < goal_count; ++ii) {
+			put<uint32_t>(record, goals[ii].pos.xx);
+			put<uint32_t>(record, goals[ii].pos.yy);
+			put<uint32_t>(record, goals[ii].range);
+		}
+		put<uint8_t>(record, result.status);
+		put<uint32_t>(record, result.ops);
+		put<uint32_t>(record, result.cost);
+		put<uint32_t>(record, result.path.size());
+		put<uint32_t>(record, recorder.room_count);
+		put_bytes(record, recorder.room_data.data(), recorder.room_data.size());
+		write(record);
+	}
+
+	bool trace_t::read_header(std::FILE* file) {
+		char header_magic[4];
+		uint32_t header_version;
+		return
+			std::fread(header_magic, 1, sizeof(header_magic), file) == sizeof(header_magic) &&
+			std::fread(&header_version, sizeof(header_version), 1, file) == 1 &&
+			std::equal(magic, magic + sizeof(magic), header_magic) &&
+			header_version == version;
+	}
+
+	bool trace_t::read(std::FILE* file, trace_record_t& record) {
+		uint32_t length;
+		if (std::fread(&length, sizeof(length), 1, file) != 1) {
+			return false;
+		}
+		std::vector<uint8_t> buffer(length);
+		if (std::fread(buffer.data(), 1, length, file) != length) {
+			return false;
+		}
+		size_t offset = 0;
+		auto get_bytes = [&](void* out, size_t size) {
+			if (offset + size > buffer.size()) {
+				throw std::runtime_error("Corrupt trace record");
+			}
+			memcpy(out, buffer.data() + offset, size);
+			offset += size;
+		};
+		auto get = [&](auto& out) {
+			get_bytes(&out, sizeof(out));
+		};
+
+		uint32_t xx, yy, range, count;
+		uint8_t flag;
+		get(xx);
+		get(yy);
+		record.origin = world_position_t(xx, yy);
+		get(record.options.plain_cost);
+		get(record.options.swamp_cost);
+		get(record.options.max_rooms);
+		get(record.options.max_ops);
+		get(record.options.max_cost);
+		get(flag);
+		record.options.flee = flag != 0;
+		get(record.options.heuristic_weight);
+		get(record.options.move_ratio);
+		get(count);
+		record.goals.clear();
+		for (uint32_t ii = 0; ii < count; ++ii) {
+			get(xx);
+			get(yy);
+			get(range);
+			record.goals.push_back(goal_t(world_position_t(xx, yy), range));
+		}
+		get(flag);
+		record.status = static_cast<search_result_t::status_t>(flag);
+		get(record.ops);
+		get(record.cost);
+		get(record.path_length);
+		get(count);
+		record.rooms.resize(count);
+		for (auto& room : record.rooms) {
+			uint16_t room_xx, room_yy;
+			get(room_xx);
+			get(room_yy);
+			room.pos = map_position_t(room_xx, room_yy);
+			get(flag);
+			room.blocked = flag & room_blocked;
+			room.has_cost_matrix = flag & room_has_cost_matrix;
+			get(room.terrain);
+			if (room.has_cost_matrix) {
+				get(room.cost_matrix);
+			}
+		}
+		return true;
+	}
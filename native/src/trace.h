@@ -0,0 +1,72 @@
+#pragma once
+#include "pf.h"
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace screeps {
+
+	//
+	// One room as the search saw it. Terrain is kept even for blocked rooms since the search loads it
+	// before asking the room provider.
+	struct trace_room_t {
+		map_position_t pos;
+		bool blocked;
+		bool has_cost_matrix;
+		uint8_t terrain[625];
+		uint8_t cost_matrix[2500];
+	};
+
+	//
+	// Everything needed to run a search again outside of v8, plus what it returned the first time
+	struct trace_record_t {
+		world_position_t origin;
+		std::vector<goal_t> goals;
+		search_options_t options;
+		std::vector<trace_room_t> rooms;
+		search_result_t::status_t status;
+		uint32_t ops;
+		cost_t cost;
+		uint32_t path_length;
+	};
+
+	//
+	// Process-wide search recorder. While it's on, a sample of searches have their inputs appended to
+	// a binary log which the `replay` tool can run again. Once the log reaches `max_bytes` recording
+	// stops on its own.
+	class trace_t {
+		private:
+			static std::atomic<bool> enabled;
+			static std::atomic<uint64_t> counter;
+			static std::atomic<uint64_t> sample_period;
+			static std::mutex mutex;
+			static std::FILE* file;
+			static size_t bytes_remaining;
+
+			static bool sample();
+			static void write(const std::vector<uint8_t>& record);
+
+		public:
+			// Starts a new log at `path`, replacing any log already in progress. `sample_rate` is the
+			// fraction of searches to record, from 0 to 1. Returns false if the file can't be opened.
+			static bool start(const std::string& path, size_t max_bytes, double sample_rate);
+			static void stop();
+
+			// Runs a search, recording it if tracing is on and this search is sampled. Aborted searches
+			// and searches which throw aren't recorded.
+			static void search(
+				path_finder_t& pf,
+				world_position_t origin, const goal_t* goals, size_t goal_count,
+				room_provider_t& rooms,
+				const search_options_t& options,
+				search_result_t& result
+			);
+
+			// Reading logs back. `read_header` returns false if `file` isn't a trace log, `read` returns
+			// false at the end of the log or if the last record was cut off.
+			static bool read_header(std::FILE* file);
+			static bool read(std::FILE* file, trace_record_t& record);
+	};
+};